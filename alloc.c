@@ -0,0 +1,163 @@
+/* alloc.c - memory allocation hooks
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * Every allocation made by the library goes through an ureg_allocator:
+ * the global one set with ureg_set_allocator(), or the one given to
+ * ureg_compile_with()/ureg_matcher_new(). Objects keep a copy of the
+ * allocator they come from, so that they are always released through it
+ * even if the global allocator changes in the meantime.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+static void *
+stdalloc(void *ctx, size_t size)
+{
+    UNUSED_PARAMETER(ctx);
+    return malloc(size);
+}
+
+static void
+stdfree(void *ctx, void *p)
+{
+    UNUSED_PARAMETER(ctx);
+    free(p);
+}
+
+static ureg_allocator global = { stdalloc, stdfree, NULL };
+
+/* Replace the global allocator, NULL restores malloc()/free() */
+void
+ureg_set_allocator(const ureg_allocator *a)
+{
+    if(a == NULL)
+    {
+        global.alloc = stdalloc;
+        global.free = stdfree;
+        global.ctx = NULL;
+    }
+    else if(a->alloc == NULL || a->free == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return;
+    }
+    else
+        global = *a;
+    ureg_errno = UREG_NOERROR;
+}
+
+/* The current global allocator */
+const ureg_allocator*
+curalloc(void)
+{
+    return &global;
+}
+
+void*
+ualloc(const ureg_allocator *a, size_t size)
+{
+    return a->alloc(a->ctx, size);
+}
+
+/* Allocate zeroed memory */
+void*
+ucalloc(const ureg_allocator *a, size_t size)
+{
+    void *p;
+
+    if((p = a->alloc(a->ctx, size)) != NULL)
+        memset(p, '\0', size);
+    return p;
+}
+
+/* Resize a block of oldsize bytes, the old block is released on success */
+void*
+urealloc(const ureg_allocator *a, void *p, size_t oldsize, size_t size)
+{
+    void *np;
+
+    if((np = a->alloc(a->ctx, size)) == NULL)
+        return NULL;
+    if(p != NULL)
+    {
+        memcpy(np, p, oldsize < size ? oldsize : size);
+        a->free(a->ctx, p);
+    }
+    return np;
+}
+
+void
+ufree(const ureg_allocator *a, void *p)
+{
+    if(p != NULL)
+        a->free(a->ctx, p);
+}
+
+/* Allocate a block aligned on a cache line boundary. *mem receives the
+ * pointer to be given to ufree().
+ */
+void*
+ulinealloc(const ureg_allocator *a, size_t size, void **mem)
+{
+    char *p;
+
+#ifdef HAVE_POSIX_MEMALIGN
+    if(a->alloc == stdalloc)
+    {
+        void *v;
+
+        if(posix_memalign(&v, UREG_CACHELINE, size) != 0)
+            return NULL;
+        *mem = v;
+        return v;
+    }
+#endif
+    if((p = (char *)a->alloc(a->ctx, size + UREG_CACHELINE - 1)) == NULL)
+        return NULL;
+    *mem = p;
+    return p + ((UREG_CACHELINE - (size_t)p % UREG_CACHELINE) % UREG_CACHELINE);
+}
+
+/* Make sure a matcher has at least size bytes of scratch memory. It is
+ * zeroed when allocated: the sparse sets of thompsonvm.c read entries
+ * they never wrote, which is fine for them but not for MSan or valgrind.
+ */
+void*
+matcherscratch(ureg_matcher m, size_t size)
+{
+    if(size > m->size)
+    {
+        ufree(&m->alloc, m->mem);
+        m->size = 0;
+        if((m->mem = ucalloc(&m->alloc, size)) == NULL)
+            return NULL;
+        m->size = size;
+    }
+    return m->mem;
+}
+
+/* Grow the scratch memory of m to at least size bytes, keeping what it
+ * holds
+ */
+void*
+matchergrow(ureg_matcher m, size_t size)
+{
+    void *mem;
+
+    if(size > m->size)
+    {
+        if((mem = urealloc(&m->alloc, m->mem, m->size, size)) == NULL)
+            return NULL;
+        /* The new part is zeroed too, see matcherscratch() */
+        memset((char *)mem + m->size, '\0', size - m->size);
+        m->mem = mem;
+        m->size = size;
+    }
+    return m->mem;
+}
@@ -0,0 +1,111 @@
+/* arena.c - bump allocator for short-lived compiler data
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * Everything allocated while compiling a single regexp (the AST, mostly)
+ * is carved out of a list of chunks and released at once by arenafree():
+ * there is no per-object free and no bookkeeping besides the chunk list.
+ *
+ * Callers never check for NULL: when the allocator fails, arenaalloc()
+ * jumps to the oom buffer given to arenainit(), from where everything
+ * in the arena is released and the failure reported. Only tools, which
+ * give none, exit instead.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+/* Size of the first chunk, doubled up to ARENA_MAXCHUNK as needed */
+#define ARENA_MINCHUNK  1024
+#define ARENA_MAXCHUNK  65536
+
+/* Alignment of every allocation */
+#define ARENA_ALIGN     (sizeof(void *) > sizeof(double) ? sizeof(void *) : sizeof(double))
+#define ARENA_ROUND(n)  (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct ArenaChunk
+{
+    ArenaChunk *next;
+    size_t size;
+};
+
+#define CHUNK_HDR       ARENA_ROUND(sizeof(ArenaChunk))
+
+void
+arenainit(Arena *a, const ureg_allocator *alloc, jmp_buf *oom)
+{
+    a->alloc = alloc;
+    a->oom = oom;
+    a->chunks = NULL;
+    a->next = NULL;
+    a->avail = 0;
+    a->chunksize = ARENA_MINCHUNK;
+}
+
+/* Allocate n zeroed bytes */
+void*
+arenaalloc(Arena *a, size_t n)
+{
+    ArenaChunk *c;
+    size_t size;
+    void *v;
+
+    n = ARENA_ROUND(n);
+    if (n > a->avail)
+    {
+        size = a->chunksize;
+        if (size < ARENA_MAXCHUNK)
+            a->chunksize *= 2;
+        if (size < n + CHUNK_HDR)
+            size = n + CHUNK_HDR;
+        if ((c = (ArenaChunk *)ualloc(a->alloc, size)) == NULL)
+        {
+            if (a->oom != NULL)
+                longjmp(*a->oom, 1);
+            fatal("out of memory");
+        }
+        c->size = size;
+        c->next = a->chunks;
+        a->chunks = c;
+        a->next = (char *)c + CHUNK_HDR;
+        a->avail = size - CHUNK_HDR;
+    }
+    v = a->next;
+    a->next += n;
+    a->avail -= n;
+    memset(v, '\0', n);
+    return v;
+}
+
+/* Grow an array allocated from a, keeping its contents. The old copy
+ * is only released with the arena: use for explicit stacks, which grow
+ * by doubling.
+ */
+void*
+arenagrow(Arena *a, void *v, size_t oldsize, size_t newsize)
+{
+    void *n;
+
+    n = arenaalloc(a, newsize);
+    if (oldsize > 0)
+        memcpy(n, v, oldsize);
+    return n;
+}
+
+/* Release everything allocated from an arena */
+void
+arenafree(Arena *a)
+{
+    ArenaChunk *c, *next;
+
+    for (c = a->chunks; c; c = next)
+    {
+        next = c->next;
+        ufree(a->alloc, c);
+    }
+    arenainit(a, a->alloc, a->oom);
+}
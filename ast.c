@@ -4,6 +4,8 @@
  */
 
 #include "stdinc.h"
+#include <ctype.h>
+#include "ureg.h"
 #define UREG_INTERNAL
 #include "ureg-internal.h"
 #include "parse.h"
@@ -16,8 +18,11 @@ typedef enum lexer_state
     BRACE
 } lexer_state_t;
 
+/* Parse s into an AST. Only UREG_CAPTURE and UREG_ANCHORED in flags
+ * change the result.
+ */
 Regexp*
-parse(const char *s)
+parse(const char *s, Arena *arena, unsigned int flags)
 {
     Regexp *dotstar;
     Parse pParse;
@@ -26,15 +31,15 @@ parse(const char *s)
     char c;
     lexer_state_t lstate = NORMAL;
     memset((void *)&pParse, '\0', sizeof(pParse));
+    pParse.arena = arena;
+    pParse.flags = flags;
 
 #if !defined(NDEBUG) && defined(UREG_TRACE)
     uregParserTrace(stderr, "uregParser -> ");
 #endif
     if (s == NULL)
         return NULL;
-    parser = uregParserAlloc(malloc);
-    if (parser == NULL)
-        return NULL;
+    parser = uregParserInit(arenaalloc(arena, uregParserSize()));
 
     c = *s++;
     value = c;
@@ -65,13 +70,24 @@ parse(const char *s)
                         break;
                     case '[':
                         token = TK_LBRACKET;
+                        if (*s == '^')
+                        {
+                            /* Negated bracket expression */
+                            s++;
+                            token = TK_NLBRACKET;
+                        }
                         lstate = BRACKET1;
                         break;
                     case ']':
                         token = TK_RBRACKET;
                         break;
                     case '(':
+                        /* Groups are numbered in the order they open:
+                         * the number goes with the token, the group is
+                         * only reduced at its closing paren
+                         */
                         token = TK_LPAREN;
+                        value = *s == '?' ? 0 : ++pParse.nparen;
                         break;
                     case ')':
                         token = TK_RPAREN;
@@ -172,23 +188,23 @@ parse(const char *s)
     }
 #endif
 
-    uregParserFree(parser, free);
-
 #if !defined(NDEBUG) && defined(UREG_TRACE)
     uregParserTrace(NULL, NULL);
 #endif
 
+    /* Partial trees are released along with the arena */
     if (pParse.parseError)
-    {
-        if (pParse.ast_root)
-            reg_destroy(pParse.ast_root);
         return NULL;
-    }
+    /* Anchored patterns only get group 0, which is kept even when empty
+     * for captures
+     */
+    if (flags & UREG_ANCHORED)
+        return reg(arena, Paren, pParse.ast_root, NULL);
     /* Change AST root to "Cat(NgStar(Dot), Paren(ast_root))" */
-    dotstar = reg(Star, reg(Dot, NULL, NULL), NULL);
+    dotstar = reg(arena, Star, reg(arena, Dot, NULL, NULL), NULL);
     dotstar->n = 1;
-    if (pParse.ast_root)
-        return reg(Cat, dotstar, reg(Paren, pParse.ast_root, NULL));
+    if (pParse.ast_root || (flags & UREG_CAPTURE))
+        return reg(arena, Cat, dotstar, reg(arena, Paren, pParse.ast_root, NULL));
     else
         return dotstar;
 }
@@ -207,49 +223,159 @@ fatal(char *fmt, ...)
     exit(2);
 }
 
-void*
-mal(size_t n)
-{
-    void *v;
-    v = malloc(n);
-    if(v == NULL)
-        fatal("out of memory");
-    memset(v, '\0', n);
-    return v;
-}
-
 /* Build a new AST node */
 Regexp*
-reg(int type, Regexp *left, Regexp *right)
+reg(Arena *arena, int type, Regexp *left, Regexp *right)
 {
     Regexp *r;
 
-    r = (Regexp *)mal(sizeof(Regexp));
+    r = (Regexp *)arenaalloc(arena, sizeof(Regexp));
     r->type = type;
     r->left = left;
-    reg_incref(left);
     r->right = right;
-    reg_incref(right);
-    r->refc = 0;
     return r;
 }
 
-/* Recursively destroy an AST branch */
+/* Add the bytes matched by single character matcher r to a class.
+ * NUL is never matched, as in the VM.
+ */
 void
-reg_destroy(Regexp *r)
+classadd(unsigned char *bits, Regexp *r)
 {
-    if (r == NULL)
-        return;
-    if (r->refc > 0)
-        fatal("reg_destroy called with non-zero refc!");
-    reg_decref(r->left);
-    reg_decref(r->right);
-    free(r);
+    int b;
+    char c;
+
+    /* Bracket members are a left-leaning alternation */
+    for (; r->type == Alt; r = r->left)
+        classadd(bits, r->right);
+    switch (r->type)
+    {
+        case Lit:
+            b = (unsigned char)r->ch;
+            bits[b >> 3] |= 1 << (b & 7);
+            break;
+        case Class:
+            for (b = 0; b < CLASSBYTES; b++)
+                bits[b] |= r->bits[b];
+            break;
+        case Dot:
+        case Range:
+            for (b = 1; b < 256; b++)
+            {
+                c = (char)b;
+                if (r->type == Dot || (c >= r->lo && c <= r->hi))
+                    bits[b >> 3] |= 1 << (b & 7);
+            }
+            break;
+    }
+}
+
+/* Smallest node for the bytes in bits: a literal, a dot or a class */
+Regexp*
+classnode(Arena *arena, unsigned char *bits)
+{
+    Regexp *r;
+    int b, n = 0, last = 0;
+
+    for (b = 1; b < 256; b++)
+    {
+        if (CLASSHAS(bits, b))
+        {
+            n++;
+            last = b;
+        }
+    }
+    if (n == 1)
+    {
+        r = reg(arena, Lit, NULL, NULL);
+        r->ch = (char)last;
+    }
+    else if (n == 255)
+        r = reg(arena, Dot, NULL, NULL);
+    else
+    {
+        r = reg(arena, Class, NULL, NULL);
+        r->bits = bits;
+    }
+    return r;
 }
 
-/* Expand and simplify counted repetitions */
+/* Bracket expression from the alternation of its members, complemented
+ * for [^...]
+ */
 Regexp*
-simplify_repeat(Regexp *r, int min, int max, int ng)
+bracket(Arena *arena, Regexp *members, int negate)
+{
+    unsigned char *bits;
+    int b;
+
+    bits = (unsigned char *)arenaalloc(arena, CLASSBYTES);
+    classadd(bits, members);
+    if (negate)
+    {
+        for (b = 0; b < CLASSBYTES; b++)
+            bits[b] = (unsigned char)~bits[b];
+        bits[0] &= ~1;
+    }
+    return classnode(arena, bits);
+}
+
+/* Width of a concatenation of single character matchers (or of
+ * alternations of them), -1 otherwise
+ */
+static int
+fixedwidth(Arena *arena, Regexp *r)
+{
+    Regexp *buf[STACKINIT], **s = buf;
+    char mbuf[STACKINIT], *alt = mbuf;
+    int n, max = STACKINIT, maxalt = STACKINIT, w = 0;
+
+    s[0] = r;
+    alt[0] = 0;
+    for (n = 1; n > 0; )
+    {
+        r = s[--n];
+        if (r == NULL)
+            return -1;
+        switch (r->type)
+        {
+            case Lit:
+            case Dot:
+            case Range:
+            case Class:
+                if (!alt[n])
+                    w++;
+                break;
+            case Str:
+                if (alt[n])
+                    return -1;
+                w += r->n;
+                break;
+            case Cat:
+                if (alt[n])
+                    return -1;
+                /* Fall through */
+            case Alt:
+                if (r->type == Alt && !alt[n])
+                    w++;
+                STACKROOM(arena, s, n, max, 2);
+                STACKROOM(arena, alt, n, maxalt, 2);
+                alt[n] = alt[n + 1] = r->type == Alt || alt[n];
+                s[n++] = r->right;
+                s[n++] = r->left;
+                break;
+            default:
+                return -1;
+        }
+    }
+    return w;
+}
+
+/* Expand a counted repetition into copies of its body. A group is only
+ * kept around the first copy, unless every copy must capture (groups).
+ */
+static Regexp*
+expand_repeat(Arena *arena, Regexp *r, int min, int max, int ng, int groups)
 {
     Regexp *nre, *r1;
     int i;
@@ -257,37 +383,34 @@ simplify_repeat(Regexp *r, int min, int max, int ng)
         return NULL;
     /* Prevent submatch blowup */
     r1 = r;
-    if (r->type == Paren)
+    if (r->type == Paren && !groups)
         r = r->left;
     /* x{n,} -> at least n matches of x */
     if (max == -1)
     {
         /* x{0,} -> x* */
         if (min == 0)
-            return reg(Star, r1, NULL);
+            return reg(arena, Star, r1, NULL);
         /* x{1,} -> x+ */
         else if (min == 1)
-            return reg(Plus, r1, NULL);
+            return reg(arena, Plus, r1, NULL);
         /* x{4,} -> xxxx+ */
         else
         {
             Regexp *plus;
-            plus = reg(Plus, r, NULL);
+            plus = reg(arena, Plus, r, NULL);
             plus->n = ng;
-            nre = reg(Cat, r1, r);
-            for (i = 2; i < min - 1; i++)
-                nre = reg(Cat, nre, r);
-            nre = reg(Cat, nre, plus);
+            nre = r1;
+            for (i = 1; i < min - 1; i++)
+                nre = reg(arena, Cat, nre, r);
+            nre = reg(arena, Cat, nre, plus);
             return nre;
         }
     }
 
     /* Empty match? */
     if (min == 0 && max == 0)
-    {
-        reg_decref(r1);
         return NULL;
-    }
 
     /* x{1} is x */
     if (min == 1 && max == 1)
@@ -306,25 +429,25 @@ simplify_repeat(Regexp *r, int min, int max, int ng)
         nre = r1;
     else if (min > 1)
     {
-        nre = reg(Cat, r1, r);
+        nre = reg(arena, Cat, r1, r);
         for (i = 2; i < min; i++)
-            nre = reg(Cat, nre, r);
+            nre = reg(arena, Cat, nre, r);
     }
 
     /* Leading suffix: (x(xx?)?)? */
     if (max > min)
     {
-        Regexp *suf = reg(Quest, r, NULL);
+        Regexp *suf = reg(arena, Quest, r, NULL);
         suf->n = ng;
         for (i = min + 1; i < max; i++)
         {
-            suf = reg(Quest, reg(Cat, r, suf), NULL);
+            suf = reg(arena, Quest, reg(arena, Cat, r, suf), NULL);
             suf->n = ng;
         }
         if (nre == NULL)
             nre = suf;
         else
-            nre = reg(Cat, nre, suf);
+            nre = reg(arena, Cat, nre, suf);
     }
 
     if (nre == NULL)
@@ -333,11 +456,68 @@ simplify_repeat(Regexp *r, int min, int max, int ng)
     return nre;
 }
 
+/* Simplify counted repetitions: long ones of fixed-width bodies become
+ * Count nodes (see Repeat), everything else is expanded. Counters cannot
+ * tell where an iteration started, so with groups (UREG_CAPTURE) bodies
+ * are always expanded, groups included.
+ */
+Regexp*
+simplify_repeat(Arena *arena, Regexp *r, int min, int max, int ng, int groups)
+{
+    Regexp *body, *nre;
+
+    if (r == NULL)
+        return NULL;
+    if (groups)
+        return expand_repeat(arena, r, min, max, ng, 1);
+    body = r->type == Paren ? r->left : r;
+    if ((max == -1 ? min : max) >= UREG_REPEAT_MIN && fixedwidth(arena, body) > 0)
+    {
+        nre = reg(arena, Count, body, NULL);
+        nre->lo = min;
+        nre->hi = max;
+        nre->n = ng;
+        return nre;
+    }
+    return expand_repeat(arena, r, min, max, ng, 0);
+}
+
+/* Expand every Count node in place, for consumers which cannot handle
+ * counters (the DFA). Returns the number of nodes expanded.
+ */
+int
+expand_counts(Arena *arena, Regexp *r)
+{
+    Regexp *buf[STACKINIT], **s = buf;
+    int ns, max = STACKINIT, n = 0;
+
+    s[0] = r;
+    for (ns = 1; ns > 0; )
+    {
+        r = s[--ns];
+        if (r == NULL)
+            continue;
+        if (r->type == Count)
+        {
+            /* Bodies are fixed width, so hold no further counters */
+            *r = *expand_repeat(arena, r->left, r->lo, r->hi, r->n, 0);
+            n++;
+            continue;
+        }
+        STACKROOM(arena, s, ns, max, 2);
+        s[ns++] = r->left;
+        s[ns++] = r->right;
+    }
+    return n;
+}
+
 #if !defined(NDEBUG) && defined(UREG_TRACE)
 /* Dump the AST (preorder traversal) */
 void
 printre(Regexp *r)
 {
+    int i;
+
     if (r == NULL)
     {
         fprintf(stderr, "NoOp");
@@ -407,6 +587,25 @@ printre(Regexp *r)
             printre(r->left);
             fprintf(stderr, ")");
             break;
+
+        case Count:
+            if (r->n)
+                fprintf(stderr, "Ng");
+            fprintf(stderr, "Count(%d, %d, ", r->lo, r->hi);
+            printre(r->left);
+            fprintf(stderr, ")");
+            break;
+
+        case Class:
+            fprintf(stderr, "Class(");
+            for (i = 0; i < 32; i++)
+                fprintf(stderr, "%02x", r->bits[i]);
+            fprintf(stderr, ")");
+            break;
+
+        case Str:
+            fprintf(stderr, "Str(%.*s)", r->n, r->str);
+            break;
     }
 }
 #endif /* !defined(NDEBUG) && defined(UREG_TRACE) */
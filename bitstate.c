@@ -0,0 +1,186 @@
+/* bitstate.c - backtracking matcher for short inputs
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * A backtracker follows one alternative at a time, in priority order:
+ * the first Match it reaches is the leftmost-first match, and captures
+ * are just positions restored on the way back, with no thread lists to
+ * maintain. A bitmap of the (instruction, position) pairs visited keeps
+ * it linear, since a pair explored once without reaching Match cannot
+ * lead to one the next time, whatever the captures. The bitmap takes a
+ * bit per instruction and input position, so the backtracker is only
+ * used when that fits in UREG_BITSTATE_MAX bits (see plan.c).
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+typedef unsigned long BitWord;
+#define WORDBITS            (8*sizeof(BitWord))
+
+/* An instruction to run at pos, or (pc < 0) capture slot -1 - pc to
+ * restore to pos
+ */
+typedef struct Job Job;
+struct Job
+{
+    int pc;
+    int pos;
+};
+
+/* Scratch layout: the capture slots, the bitmap, then the job stack,
+ * which grows as needed
+ */
+typedef struct BitState BitState;
+struct BitState
+{
+    ureg_matcher m;
+    size_t mapoff, joboff;
+    int *cap;
+    BitWord *visited;
+    Job *job;
+    int njob, maxjob;
+};
+
+#define BITSTATE_ROUND(n)   (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static void
+bslayout(BitState *b, char *mem)
+{
+    b->cap = (int *)mem;
+    b->visited = (BitWord *)(mem + b->mapoff);
+    b->job = (Job *)(mem + b->joboff);
+}
+
+static int
+push(BitState *b, int pc, int pos)
+{
+    char *mem;
+
+    if (b->njob == b->maxjob)
+    {
+        mem = (char *)matchergrow(b->m, b->joboff + 2*(size_t)b->maxjob*sizeof(Job));
+        if (mem == NULL)
+            return 0;
+        b->maxjob *= 2;
+        bslayout(b, mem);
+    }
+    b->job[b->njob].pc = pc;
+    b->job[b->njob].pos = pos;
+    b->njob++;
+    return 1;
+}
+
+/* Find the leftmost-first match of p in s, which is len bytes long.
+ * Returns 1 on match, with the first ncap groups in caps (which may be
+ * NULL if ncap is 0).
+ */
+int
+bitstate(Prog *p, const char *s, int len, int *caps, int ncap, ureg_matcher m)
+{
+    BitState b;
+    Inst *ip;
+    char *mem;
+    size_t k, nbits;
+    int i, pc, pos;
+
+    /* Slots past the requested groups are never looked at */
+    nbits = (size_t)p->len*(len + 1);
+    b.m = m;
+    b.mapoff = BITSTATE_ROUND(2*(size_t)ncap*sizeof(int));
+    b.joboff = b.mapoff + BITSTATE_ROUND((nbits + WORDBITS - 1) / WORDBITS*sizeof(BitWord));
+    b.njob = 0;
+    b.maxjob = 16 + p->len;
+    if ((mem = (char *)matcherscratch(m, b.joboff + (size_t)b.maxjob*sizeof(Job))) == NULL)
+        goto nomem;
+    bslayout(&b, mem);
+    memset(b.visited, '\0', b.joboff - b.mapoff);
+    for (i = 0; i < 2*ncap; i++)
+        b.cap[i] = -1;
+
+    push(&b, 0, 0);
+    while (b.njob > 0)
+    {
+        b.njob--;
+        pc = b.job[b.njob].pc;
+        pos = b.job[b.njob].pos;
+        if (pc < 0)
+        {
+            b.cap[-1 - pc] = pos;
+            continue;
+        }
+        for (;;)
+        {
+            k = (size_t)pc*(len + 1) + pos;
+            if (b.visited[k / WORDBITS] & ((BitWord)1 << (k % WORDBITS)))
+                break;
+            b.visited[k / WORDBITS] |= (BitWord)1 << (k % WORDBITS);
+            ip = p->start + pc;
+            switch (ip->opcode)
+            {
+                case Match:
+                    for (i = 0; i < 2*ncap; i++)
+                        caps[i] = b.cap[i];
+                    return 1;
+                case Jmp:
+                    pc = ip->x;
+                    continue;
+                case Split:
+                    /* y is tried once everything after x has failed */
+                    if (!push(&b, ip->y, pos))
+                        goto nomem;
+                    pc = ip->x;
+                    continue;
+                case Save:
+                    if (ip->n < 2*ncap)
+                    {
+                        if (!push(&b, -1 - ip->n, b.cap[ip->n]))
+                            goto nomem;
+                        b.cap[ip->n] = pos;
+                    }
+                    pc++;
+                    continue;
+                case Char:
+                    if (s[pos] != ip->c)
+                        break;
+                    pc++;
+                    pos++;
+                    continue;
+                case Rng:
+                    if (s[pos] < ip->lo || s[pos] > ip->hi)
+                        break;
+                    /* Fall through */
+                case Any:
+                    if (s[pos] == '\0')
+                        break;
+                    pc++;
+                    pos++;
+                    continue;
+                case Set:
+                    /* NUL is never in the set */
+                    if (!CLASSHAS(PROGCLASS(p, ip->y), s[pos]))
+                        break;
+                    pc++;
+                    pos++;
+                    continue;
+                case String:
+                    /* Literals hold no NUL, so this stops at the end */
+                    if (strncmp(s + pos, PROGSTR(p) + ip->y, ip->n) != 0)
+                        break;
+                    pc++;
+                    pos += ip->n;
+                    continue;
+            }
+            break;
+        }
+    }
+    return 0;
+
+nomem:
+    ureg_errno = UREG_ERR_NOMEM;
+    return -1;
+}
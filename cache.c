@@ -0,0 +1,315 @@
+/* cache.c - thread-safe cache of compiled regexps
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * The cache is split in CACHE_STRIPES independent stripes, selected by
+ * the hash of (pattern, flags), each with its own lock, hash table and
+ * LRU list: threads looking up different patterns seldom contend for the
+ * same lock. Compilation happens outside of the lock; if two threads miss
+ * on the same pattern at once, the loser throws its copy away and uses
+ * the one already in the cache.
+ *
+ * Cached handles are reference counted: the cache holds one reference
+ * and every successful ureg_cache_compile() hands out another one, to be
+ * dropped with ureg_free(). Eviction only drops the cache's reference.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+typedef pthread_mutex_t Lock;
+# define lockinit(l)    pthread_mutex_init((l), NULL)
+# define lockfree(l)    pthread_mutex_destroy(l)
+# define lock(l)        pthread_mutex_lock(l)
+# define unlock(l)      pthread_mutex_unlock(l)
+#else
+/* No threads, no locks */
+typedef int Lock;
+# define lockinit(l)    (*(l) = 0)
+# define lockfree(l)    UNUSED_PARAMETER(l)
+# define lock(l)        UNUSED_PARAMETER(l)
+# define unlock(l)      UNUSED_PARAMETER(l)
+#endif /* HAVE_PTHREAD */
+
+/* Number of stripes, must be a power of 2 */
+#define CACHE_STRIPES   16
+/* Hash buckets per stripe, must be a power of 2 */
+#define CACHE_BUCKETS   64
+
+typedef struct Entry Entry;
+struct Entry
+{
+    unsigned int hash;
+    unsigned int flags;
+    ureg_regexp re;
+    /* Hash chain */
+    Entry *next;
+    /* LRU list, most recently used first */
+    Entry *lprev, *lnext;
+};
+
+typedef struct Stripe Stripe;
+struct Stripe
+{
+    Lock lock;
+    Entry *buckets[CACHE_BUCKETS];
+    Entry *head, *tail;
+    size_t count, capacity;
+    unsigned long hits, misses, evictions;
+};
+
+struct ureg_cache_t
+{
+    Stripe stripes[CACHE_STRIPES];
+    /* Allocator for the cache, its entries and compiled regexps */
+    ureg_allocator alloc;
+};
+
+#if !defined(HAVE_SYNC_BUILTINS)
+/* Fallback reference counting */
+# ifdef HAVE_PTHREAD
+static pthread_mutex_t reflock = PTHREAD_MUTEX_INITIALIZER;
+# else
+static Lock reflock;
+# endif
+
+int
+ureg_refinc(int *p)
+{
+    int v;
+
+    lock(&reflock);
+    v = ++(*p);
+    unlock(&reflock);
+    return v;
+}
+
+int
+ureg_refdec(int *p)
+{
+    int v;
+
+    lock(&reflock);
+    v = --(*p);
+    unlock(&reflock);
+    return v;
+}
+#endif /* !HAVE_SYNC_BUILTINS */
+
+static unsigned int
+keyhash(const char *pattern, unsigned int flags)
+{
+    unsigned int h = 2166136261U;
+
+    for (; *pattern; pattern++)
+        h = (h ^ (unsigned char)*pattern) * 16777619U;
+    return (h ^ flags) * 16777619U;
+}
+
+static void
+lruunlink(Stripe *s, Entry *e)
+{
+    if (e->lprev)
+        e->lprev->lnext = e->lnext;
+    else
+        s->head = e->lnext;
+    if (e->lnext)
+        e->lnext->lprev = e->lprev;
+    else
+        s->tail = e->lprev;
+}
+
+static void
+lrupush(Stripe *s, Entry *e)
+{
+    e->lprev = NULL;
+    e->lnext = s->head;
+    if (s->head)
+        s->head->lprev = e;
+    else
+        s->tail = e;
+    s->head = e;
+}
+
+static Entry*
+find(Stripe *s, unsigned int hash, const char *pattern, unsigned int flags)
+{
+    Entry *e;
+
+    for (e = s->buckets[(hash / CACHE_STRIPES) & (CACHE_BUCKETS - 1)]; e; e = e->next)
+        if (e->hash == hash && e->flags == flags && strcmp(e->re->txt, pattern) == 0)
+            return e;
+    return NULL;
+}
+
+/* Drop the least recently used entry of a stripe */
+static void
+evict(struct ureg_cache_t *c, Stripe *s)
+{
+    Entry *e = s->tail, **pe;
+
+    lruunlink(s, e);
+    pe = &s->buckets[(e->hash / CACHE_STRIPES) & (CACHE_BUCKETS - 1)];
+    while (*pe != e)
+        pe = &(*pe)->next;
+    *pe = e->next;
+    s->count--;
+    s->evictions++;
+    ureg_free(e->re);
+    ufree(&c->alloc, e);
+}
+
+/* Create a cache */
+ureg_cache
+ureg_cache_new(size_t capacity)
+{
+    struct ureg_cache_t *c;
+    int i;
+
+    if (capacity == 0)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return NULL;
+    }
+    if ((c = (struct ureg_cache_t *)ucalloc(curalloc(), sizeof(*c))) == NULL)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        return NULL;
+    }
+    c->alloc = *curalloc();
+    for (i = 0; i < CACHE_STRIPES; i++)
+    {
+        lockinit(&c->stripes[i].lock);
+        c->stripes[i].capacity = (capacity + CACHE_STRIPES - 1) / CACHE_STRIPES;
+    }
+    ureg_errno = UREG_NOERROR;
+    return c;
+}
+
+/* Look up a regexp, compiling it on a miss */
+ureg_regexp
+ureg_cache_compile(ureg_cache cache, const char *pattern, unsigned int flags)
+{
+    Stripe *s;
+    Entry *e, *ne;
+    ureg_regexp re;
+    unsigned int hash;
+
+    if (cache == NULL || pattern == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return NULL;
+    }
+    hash = keyhash(pattern, flags);
+    s = &cache->stripes[hash & (CACHE_STRIPES - 1)];
+
+    lock(&s->lock);
+    if ((e = find(s, hash, pattern, flags)) != NULL)
+    {
+        s->hits++;
+        lruunlink(s, e);
+        lrupush(s, e);
+        re = e->re;
+        ureg_refinc(&re->refc);
+        unlock(&s->lock);
+        ureg_errno = UREG_NOERROR;
+        return re;
+    }
+    s->misses++;
+    unlock(&s->lock);
+
+    /* Compile without holding the lock */
+    if ((re = ureg_compile_with(pattern, flags, &cache->alloc)) == NULL)
+        return NULL;
+    if ((ne = (Entry *)ualloc(&cache->alloc, sizeof(Entry))) == NULL)
+    {
+        /* Still usable, just not cached */
+        ureg_errno = UREG_NOERROR;
+        return re;
+    }
+    ne->hash = hash;
+    ne->flags = flags;
+    ne->re = re;
+
+    lock(&s->lock);
+    if ((e = find(s, hash, pattern, flags)) != NULL)
+    {
+        /* Somebody else got here first */
+        ufree(&cache->alloc, ne);
+        ureg_free(re);
+        re = e->re;
+        lruunlink(s, e);
+        lrupush(s, e);
+    }
+    else
+    {
+        if (s->count >= s->capacity)
+            evict(cache, s);
+        ne->next = s->buckets[(hash / CACHE_STRIPES) & (CACHE_BUCKETS - 1)];
+        s->buckets[(hash / CACHE_STRIPES) & (CACHE_BUCKETS - 1)] = ne;
+        lrupush(s, ne);
+        s->count++;
+    }
+    /* One reference for the cache, one for the caller */
+    ureg_refinc(&re->refc);
+    unlock(&s->lock);
+    ureg_errno = UREG_NOERROR;
+    return re;
+}
+
+/* Collect statistics */
+void
+ureg_cache_getstats(ureg_cache cache, ureg_cache_stats *stats)
+{
+    Stripe *s;
+    int i;
+
+    if (cache == NULL || stats == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return;
+    }
+    memset(stats, '\0', sizeof(*stats));
+    for (i = 0; i < CACHE_STRIPES; i++)
+    {
+        s = &cache->stripes[i];
+        lock(&s->lock);
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->evictions += s->evictions;
+        stats->entries += s->count;
+        unlock(&s->lock);
+    }
+    ureg_errno = UREG_NOERROR;
+}
+
+/* Destroy a cache, dropping its references to cached regexps */
+void
+ureg_cache_free(ureg_cache cache)
+{
+    ureg_allocator alloc;
+    Stripe *s;
+    int i;
+
+    if (cache == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return;
+    }
+    for (i = 0; i < CACHE_STRIPES; i++)
+    {
+        s = &cache->stripes[i];
+        while (s->tail)
+            evict(cache, s);
+        lockfree(&s->lock);
+    }
+    alloc = cache->alloc;
+    ufree(&alloc, cache);
+    ureg_errno = UREG_NOERROR;
+}
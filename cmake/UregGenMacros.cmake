@@ -0,0 +1,12 @@
+# Compile the patterns listed in SRCFILE into C matchers (see ureg-gen/ureg-gen.c).
+# Generates ${SRCBASE}.c and ${SRCBASE}.h in the current binary directory;
+# add the former to the sources of the target using the matchers.
+MACRO(UREG_GEN SRCFILE)
+    GET_FILENAME_COMPONENT(SRCBASE ${SRCFILE} NAME_WE)
+    ADD_CUSTOM_COMMAND(OUTPUT ${CMAKE_CURRENT_BINARY_DIR}/${SRCBASE}.c ${CMAKE_CURRENT_BINARY_DIR}/${SRCBASE}.h
+        COMMAND ureg-gen
+        ARGS ${CMAKE_CURRENT_SOURCE_DIR}/${SRCFILE} ${CMAKE_CURRENT_BINARY_DIR}/${SRCBASE}.c ${CMAKE_CURRENT_BINARY_DIR}/${SRCBASE}.h
+        DEPENDS ureg-gen ${CMAKE_CURRENT_SOURCE_DIR}/${SRCFILE}
+        COMMENT "Generating ${SRCBASE}.c from ${SRCFILE}"
+    )
+ENDMACRO(UREG_GEN)
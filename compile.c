@@ -4,177 +4,808 @@
  */
 
 #include "stdinc.h"
+#include "ureg.h"
 #define UREG_INTERNAL
 #include "ureg-internal.h"
 
-static int count(Regexp *);
-static void emit(Regexp *, Inst **);
+/* Upper bounds on the space needed to compile an AST */
+typedef struct Sizes Sizes;
+struct Sizes
+{
+    int inst;
+    int nrepeat;
+    int nstr;
+    int nclass;
+};
+
+/* First-byte sets of closures, added to the class bit sets of p */
+typedef struct FirstSets FirstSets;
+struct FirstSets
+{
+    unsigned char *sets;
+    int n, max;
+    /* Open addressing over the classes of p, then sets (-1: free) */
+    int *hash;
+    unsigned int mask;
+};
+
+static void sizes(Regexp *, Arena *, Sizes *);
+static int tableused(Prog *, int, int);
+static int peephole(Prog *, int, Arena *, int);
+static int closures(Prog *, Arena *, int **, FirstSets *);
+static void emit(Regexp *, Prog *, int *, Arena *);
+static int emitbody(Regexp *, Prog *, int *, Arena *);
 
-/* Compile an AST into an instruction stream */
+/* Compile an AST into an instruction stream. The program is allocated
+ * from arena, callers copy it to its final location (see progsize()).
+ * Save instructions are only kept with UREG_CAPTURE in flags.
+ */
 Prog*
-compile(Regexp *r)
+compile(Regexp *r, Arena *arena, unsigned int flags)
 {
-    int n;
-    Prog *p;
-    Inst *pc;
+    int pc, nclosure;
+    Sizes z;
+    RepeatArgs *a, *repeats;
+    unsigned char *classes;
+    char *str;
+    int *clos;
+    FirstSets fs;
+    Prog *p, *q;
 
-    n = count(r) + 1;
-    p = (Prog *)mal(sizeof(Prog) + n*sizeof(p->start[0]));
-    p->start = (Inst *)(p+1);
-    pc = p->start;
-    emit(r, &pc);
-    pc->opcode = Match;
+    sizes(r, arena, &z);
+    z.inst++;
+    p = (Prog *)arenaalloc(arena, PROGSIZE(z.inst, z.nrepeat, 0, z.nstr, z.nclass));
+    /* sizes() gives only upper bounds: tables are collected past the
+     * instructions, then moved down
+     */
+    p->len = z.inst;
+    p->nrepeat = z.nrepeat;
+    p->nclosure = 0;
+    p->nstr = z.nstr;
+    p->nclass = 0;
+    pc = 0;
+    emit(r, p, &pc, arena);
+    p->start[pc].opcode = Match;
     pc++;
-    p->len = pc - p->start;
-    return p;
+    pc = peephole(p, pc, arena, (flags & UREG_CAPTURE) != 0);
+    repeats = PROGREPEAT(p, 0);
+    str = PROGSTR(p);
+    classes = PROGCLASS(p, 0);
+    p->len = pc;
+    p->nrepeat = tableused(p, pc, Repeat);
+    p->nstr = tableused(p, pc, String);
+    memmove(PROGREPEAT(p, 0), repeats, (size_t)p->nrepeat*sizeof(RepeatArgs));
+    memmove(PROGSTR(p), str, p->nstr);
+    memmove(PROGCLASS(p, 0), classes, (size_t)p->nclass*CLASSBYTES);
+
+    /* Lay out the counters of Repeat instructions */
+    p->ncount = 0;
+    for (pc = 0; pc < p->len; pc++)
+    {
+        if (p->start[pc].opcode == Repeat)
+        {
+            a = PROGREPEAT(p, p->start[pc].y);
+            a->cnt = p->ncount;
+            p->ncount += (int)REPEATWORDS(p->start + pc, a);
+        }
+    }
+
+    /* Closure tables go between Repeat parameters and literals, their
+     * first-byte sets after the other bit sets
+     */
+    nclosure = closures(p, arena, &clos, &fs);
+    if (nclosure == 0)
+        return p;
+    q = (Prog *)arenaalloc(arena, PROGSIZE(p->len, p->nrepeat, nclosure,
+                                           p->nstr, p->nclass + fs.n));
+    memcpy(q, p, (char *)PROGCLOSURE(p) - (char *)p);
+    q->nclosure = nclosure;
+    q->nclass = p->nclass + fs.n;
+    memcpy(PROGCLOSURE(q), clos, nclosure*sizeof(int));
+    memcpy(PROGSTR(q), PROGSTR(p), p->nstr + (size_t)p->nclass*CLASSBYTES);
+    memcpy(PROGCLASS(q, p->nclass), fs.sets, (size_t)fs.n*CLASSBYTES);
+    return q;
 }
 
+static const unsigned char*
+fsbits(Prog *p, FirstSets *f, int k)
+{
+    if (k < p->nclass)
+        return PROGCLASS(p, k);
+    return f->sets + (size_t)(k - p->nclass)*CLASSBYTES;
+}
+
+/* Slot of bits in the hash table: where it is, or the free one to put
+ * it in
+ */
 static int
-count(Regexp *r)
+fsslot(Prog *p, FirstSets *f, const unsigned char *bits)
 {
-    if (r == NULL)
-        return 0;
+    unsigned int h = 2166136261U;
+    int b;
 
-    switch(r->type)
-    {
-        default:
-            fatal("PUPPA/2!");
-            break;
-        case Alt:
-            return 2 + count(r->left) + count(r->right);
-            break;
-        case Cat:
-            return 2 + count(r->left) + count(r->right);
-            break;
-        case Lit:
-        case Dot:
-        case Range:
-            return 1;
-            break;
-        case Quest:
-            return 1 + count(r->left);
-            break;
-        case Star:
-            return 2 + count(r->left);
-            break;
-        case Plus:
-            return 1 + count(r->left);
-            break;
-        case Paren:
-            return 2 + count(r->left);
+    for (b = 0; b < CLASSBYTES; b++)
+        h = (h ^ bits[b]) * 16777619U;
+    for (h &= f->mask; f->hash[h] != -1; h = (h + 1) & f->mask)
+        if (memcmp(fsbits(p, f, f->hash[h]), bits, CLASSBYTES) == 0)
             break;
+    return (int)h;
+}
+
+/* Room for the first-byte sets of up to n closures */
+static void
+fsinit(Prog *p, Arena *arena, FirstSets *f, int n)
+{
+    unsigned int size;
+    int k;
+
+    for (size = 16; size < 2*(unsigned int)(p->nclass + n); size *= 2)
+        ;
+    f->hash = (int *)arenaalloc(arena, size*sizeof(int));
+    memset(f->hash, 0xff, size*sizeof(int));
+    f->mask = size - 1;
+    f->n = 0;
+    f->max = STACKINIT;
+    f->sets = (unsigned char *)arenaalloc(arena, f->max*CLASSBYTES);
+    for (k = 0; k < p->nclass; k++)
+        f->hash[fsslot(p, f, PROGCLASS(p, k))] = k;
+}
+
+/* Class index of the bytes the n instructions in v accept first, -1 if
+ * some thread there gets past any byte (Match, Repeat)
+ */
+static int
+firstset(Prog *p, Arena *arena, FirstSets *f, const int *v, int n)
+{
+    unsigned char bits[CLASSBYTES];
+    Inst *pc;
+    int i, b, h;
+
+    memset(bits, '\0', CLASSBYTES);
+    for (i = 0; i < n; i++)
+    {
+        pc = p->start + v[i];
+        switch (pc->opcode)
+        {
+            case Match:
+            case Repeat:
+                return -1;
+            case Char:
+            case String:
+                b = (unsigned char)(pc->opcode == Char ? pc->c : PROGSTR(p)[pc->y]);
+                bits[b >> 3] |= 1 << (b & 7);
+                break;
+            case Set:
+                for (b = 0; b < CLASSBYTES; b++)
+                    bits[b] |= PROGCLASS(p, pc->y)[b];
+                break;
+            case Any:
+            case Rng:
+                /* As compared by the VM, NUL never matches */
+                for (b = 1; b < 256; b++)
+                    if (pc->opcode == Any || ((char)b >= pc->lo && (char)b <= pc->hi))
+                        bits[b >> 3] |= 1 << (b & 7);
+                break;
+        }
+    }
+    h = fsslot(p, f, bits);
+    if (f->hash[h] == -1)
+    {
+        if (f->n == f->max)
+        {
+            f->sets = (unsigned char *)arenagrow(arena, f->sets, (size_t)f->max*CLASSBYTES,
+                                                 (size_t)2*f->max*CLASSBYTES);
+            f->max *= 2;
+        }
+        memcpy(f->sets + (size_t)f->n*CLASSBYTES, bits, CLASSBYTES);
+        f->hash[h] = p->nclass + f->n++;
+    }
+    return f->hash[h];
+}
+
+/* Largest closure table built, in words, for a program of len
+ * instructions; bigger tables are not worth the memory
+ */
+#define CLOSUREMAX(len)     (8*(len) + 256)
+
+/* Epsilon closure tables of p (see PROGCLOSURE()), allocated from arena.
+ * Returns their size in words, 0 if they would be too big.
+ */
+static int
+closures(Prog *p, Arena *arena, int **tab, FirstSets *fs)
+{
+    int *t, *mark, *stack;
+    char *entry;
+    Inst *pc;
+    int i, j, n, cnt, size, max;
+
+    max = CLOSUREMAX(p->len);
+    t = (int *)arenaalloc(arena, max*sizeof(int));
+    mark = (int *)arenaalloc(arena, p->len*sizeof(int));
+    stack = (int *)arenaalloc(arena, (2*p->len + 1)*sizeof(int));
+    entry = (char *)arenaalloc(arena, p->len);
+    fsinit(p, arena, fs, p->len);
+
+    /* Where threads are added after consuming a byte */
+    entry[0] = 1;
+    for (i = 0; i < p->len; i++)
+    {
+        switch (p->start[i].opcode)
+        {
+            case Char:
+            case Any:
+            case Rng:
+            case Set:
+            case String:
+                entry[i + 1] = 1;
+                break;
+            case Repeat:
+                entry[p->start[i].x] = 1;
+                break;
+        }
+    }
+
+    size = p->len;
+    for (i = 0; i < p->len; i++)
+    {
+        t[i] = -1;
+        pc = p->start + i;
+        if (!entry[i] || (pc->opcode != Jmp && pc->opcode != Split && pc->opcode != Save))
+            continue;
+        if (size + 2 > max)
+            return 0;
+        t[i] = size;
+        size += 2;
+        /* Same order as a recursive walk taking x before y */
+        cnt = 0;
+        stack[0] = i;
+        for (n = 1; n > 0; )
+        {
+            j = stack[--n];
+            if (mark[j] == i + 1)
+                continue;
+            mark[j] = i + 1;
+            pc = p->start + j;
+            switch (pc->opcode)
+            {
+                case Jmp:
+                    stack[n++] = pc->x;
+                    continue;
+                case Split:
+                    stack[n++] = pc->y;
+                    stack[n++] = pc->x;
+                    continue;
+                case Save:
+                    stack[n++] = j + 1;
+                    continue;
+                case Repeat:
+                    if (PROGREPEAT(p, pc->y)->lo == 0)
+                        stack[n++] = pc->x;
+                    break;
+            }
+            if (size >= max)
+                return 0;
+            t[size++] = j;
+            cnt++;
+        }
+        t[t[i]] = cnt;
+        t[t[i] + 1] = firstset(p, arena, fs, t + t[i] + 2, cnt);
+    }
+    *tab = t;
+    return size > p->len ? size : 0;
+}
+
+/* Final target of a chain of jumps */
+static int
+jmptarget(Prog *p, int i, int len)
+{
+    int n;
+
+    /* A cycle of jumps goes nowhere, just stop somewhere in it */
+    for (n = 0; p->start[i].opcode == Jmp && n < len; n++)
+        i = p->start[i].x;
+    return i;
+}
+
+/* Clean up the control flow left by emit() in the first len instructions
+ * of p: Save instructions go away unless saves is set (only captures
+ * read them), jumps to jumps are threaded, a Split with equal targets
+ * becomes a Jmp, and jumps to the next instruction as well as
+ * unreachable code are removed. Returns
+ * the new length; relative order is preserved, so Repeat bodies and
+ * String offsets stay valid.
+ */
+static int
+peephole(Prog *p, int len, Arena *arena, int saves)
+{
+    int *map, *stack;
+    char *live;
+    Inst *pc;
+    int i, j, k, n, to[2];
+
+    for (i = 0; i < len && !saves; i++)
+    {
+        pc = p->start + i;
+        if (pc->opcode == Save)
+        {
+            pc->opcode = Jmp;
+            pc->x = i + 1;
+        }
+    }
+    for (i = 0; i < len; i++)
+    {
+        pc = p->start + i;
+        if (pc->opcode == Jmp || pc->opcode == Split)
+            pc->x = jmptarget(p, pc->x, len);
+        if (pc->opcode == Split)
+        {
+            pc->y = jmptarget(p, pc->y, len);
+            if (pc->x == pc->y)
+                pc->opcode = Jmp;
+        }
+    }
+
+    /* Mark what can be reached from the start */
+    map = (int *)arenaalloc(arena, len*sizeof(int));
+    stack = (int *)arenaalloc(arena, len*sizeof(int));
+    live = (char *)arenaalloc(arena, len);
+    live[0] = 1;
+    stack[0] = 0;
+    for (n = 1; n > 0; )
+    {
+        i = stack[--n];
+        pc = p->start + i;
+        k = 1;
+        switch (pc->opcode)
+        {
+            case Match:
+                k = 0;
+                break;
+            case Jmp:
+                to[0] = pc->x;
+                break;
+            case Split:
+                to[0] = pc->x;
+                to[1] = pc->y;
+                k = 2;
+                break;
+            case Repeat:
+                /* The body is only entered through the Repeat */
+                for (j = i + 1; j < pc->x; j++)
+                    live[j] = 1;
+                to[0] = pc->x;
+                break;
+            default:
+                to[0] = i + 1;
+                break;
+        }
+        for (j = 0; j < k; j++)
+        {
+            if (!live[to[j]])
+            {
+                live[to[j]] = 1;
+                stack[n++] = to[j];
+            }
+        }
+    }
+
+    /* A jump to the first live instruction after it falls through */
+    for (i = len - 1, k = -1; i >= 0; i--)
+    {
+        if (live[i] && p->start[i].opcode == Jmp && p->start[i].x == k)
+            live[i] = 0;
+        if (live[i])
+            k = i;
+    }
+
+    /* Renumber: dropped instructions take the index of the next live
+     * one, which is where a jump to them ends up
+     */
+    for (i = 0, k = 0; i < len; i++)
+        if (live[i])
+            map[i] = k++;
+    for (i = len - 1, j = k; i >= 0; i--)
+    {
+        if (live[i])
+            j = map[i];
+        else
+            map[i] = j;
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (!live[i])
+            continue;
+        pc = p->start + map[i];
+        *pc = p->start[i];
+        if (pc->opcode == Jmp || pc->opcode == Split || pc->opcode == Repeat)
+            pc->x = map[pc->x];
+        if (pc->opcode == Split)
+            pc->y = map[pc->y];
     }
-    /* Not reached */
+    return k;
+}
+
+/* Size in bytes of a compiled program */
+size_t
+progsize(Prog *p)
+{
+    return PROGSIZE(p->len, p->nrepeat, p->nclosure, p->nstr, p->nclass);
 }
 
+/* A node on an explicit stack. state is the number of children already
+ * emitted (emit()), or whether r is in a Count body (sizes()) or in an
+ * alternation of one (emitbody()); t is an instruction left to patch.
+ */
+typedef struct Walk Walk;
+struct Walk
+{
+    Regexp *r;
+    int state;
+    int t;
+};
+
 static void
-emit(Regexp *r, Inst **pc)
+sizes(Regexp *r, Arena *arena, Sizes *z)
+{
+    Walk buf[STACKINIT], *s = buf;
+    int n, max = STACKINIT, body;
+
+    z->inst = z->nrepeat = z->nstr = z->nclass = 0;
+    s[0].r = r;
+    s[0].state = 0;
+    for (n = 1; n > 0; )
+    {
+        r = s[--n].r;
+        body = s[n].state;
+        if (r == NULL)
+            continue;
+        STACKROOM(arena, s, n, max, 2);
+        switch(r->type)
+        {
+            default:
+                fatal("PUPPA/2!");
+                break;
+            case Alt:
+            case Cat:
+                /* Count bodies only emit their single character matchers */
+                if (!body)
+                    z->inst += 2;
+                s[n].r = r->right;
+                s[n++].state = body;
+                s[n].r = r->left;
+                s[n++].state = body;
+                break;
+            case Class:
+                z->nclass++;
+                /* Fall through */
+            case Lit:
+            case Dot:
+            case Range:
+                z->inst++;
+                break;
+            case Str:
+                z->inst += body ? r->n : 1;
+                z->nstr += r->n;
+                break;
+            case Quest:
+            case Plus:
+                z->inst++;
+                s[n].r = r->left;
+                s[n++].state = 0;
+                break;
+            case Star:
+            case Paren:
+                z->inst += 2;
+                s[n].r = r->left;
+                s[n++].state = 0;
+                break;
+            case Count:
+                z->inst++;
+                z->nrepeat++;
+                s[n].r = r->left;
+                s[n++].state = 1;
+                break;
+        }
+    }
+}
+
+/* Table entries (Repeat) or bytes (String) used by the instructions of
+ * type op before pc. Instructions are emitted in order, so the last one
+ * tells.
+ */
+static int
+tableused(Prog *p, int pc, int op)
 {
-    Inst *p1, *p2, *t;
-    int i;
+    while (--pc >= 0)
+    {
+        if (p->start[pc].opcode == op)
+        {
+            if (op == String)
+                return p->start[pc].y + p->start[pc].n;
+            return p->start[pc].y + 1;
+        }
+    }
+    return 0;
+}
+
+/* Index of a bit set in p, added if not already there */
+static int
+addclass(Prog *p, const unsigned char *bits)
+{
+    int k;
 
-    if (r == NULL)
-        return;
+    for (k = 0; k < p->nclass; k++)
+        if (memcmp(PROGCLASS(p, k), bits, CLASSBYTES) == 0)
+            return k;
+    memcpy(PROGCLASS(p, k), bits, CLASSBYTES);
+    return p->nclass++;
+}
 
+/* Emit a single instruction matcher */
+static void
+emitleaf(Regexp *r, Prog *p, int *pc)
+{
+    Inst *i1;
+
+    i1 = p->start + *pc;
     switch(r->type)
     {
         default:
             fatal("bad emit (PUPPA/3!)");
             break;
 
-        case Alt:
-            (*pc)->opcode = Split;
-            p1 = (*pc)++;
-            p1->x = *pc;
-            emit(r->left, pc);
-            (*pc)->opcode = Jmp;
-            p2 = (*pc)++;
-            p1->y = *pc;
-            emit(r->right, pc);
-            p2->x = *pc;
-            break;
-
-        case Cat:
-            emit(r->left, pc);
-            emit(r->right, pc);
-            break;
-
         case Lit:
-            (*pc)->opcode = Char;
-            (*pc)->c = r->ch;
-            (*pc)++;
+            i1->opcode = Char;
+            i1->c = r->ch;
             break;
 
         case Dot:
-            (*pc)->opcode = Any;
-            (*pc)++;
+            i1->opcode = Any;
             break;
 
         case Range:
-            (*pc)->opcode = Rng;
-            (*pc)->lo = r->lo;
-            (*pc)->hi = r->hi;
-            (*pc)++;
+            i1->opcode = Rng;
+            i1->lo = r->lo;
+            i1->hi = r->hi;
             break;
 
-        case Quest:
-            (*pc)->opcode = Split;
-            p1 = (*pc)++;
-            p1->x = *pc;
-            emit(r->left, pc);
-            p1->y = *pc;
-            if(r->n)
-            {
-                /* Non-greedy */
-                t = p1->x;
-                p1->x = p1->y;
-                p1->y = t;
-            }
+        case Class:
+            i1->opcode = Set;
+            i1->y = addclass(p, r->bits);
             break;
 
-        case Star:
-            (*pc)->opcode = Split;
-            p1 = (*pc)++;
-            p1->x = *pc;
-            emit(r->left, pc);
-            (*pc)->opcode = Jmp;
-            (*pc)->x = p1;
-            (*pc)++;
-            p1->y = *pc;
-            if(r->n)
-            {
-                t = p1->x;
-                p1->x = p1->y;
-                p1->y = t;
-            }
+        case Str:
+            i1->opcode = String;
+            i1->y = tableused(p, *pc, String);
+            i1->n = r->n;
+            memcpy(PROGSTR(p) + i1->y, r->str, r->n);
             break;
+    }
+    (*pc)++;
+}
+
+/* Emit r at *pc. Nodes are walked with an explicit stack: state counts
+ * the children already emitted, t holds an instruction to patch.
+ */
+static void
+emit(Regexp *r, Prog *p, int *pc, Arena *arena)
+{
+    Walk buf[STACKINIT], *s = buf, *f;
+    Regexp *child = NULL;
+    Inst *i1;
+    int n, max = STACKINIT, state, t;
+
+    s[0].r = r;
+    s[0].state = 0;
+    for (n = 1; n > 0; )
+    {
+        f = &s[n - 1];
+        r = f->r;
+        state = f->state++;
+        if (r == NULL)
+        {
+            n--;
+            continue;
+        }
+
+        switch(r->type)
+        {
+            default:
+                emitleaf(r, p, pc);
+                n--;
+                continue;
+
+            case Alt:
+                if (state == 0)
+                {
+                    f->t = (*pc)++;
+                    i1 = p->start + f->t;
+                    i1->opcode = Split;
+                    i1->x = *pc;
+                    child = r->left;
+                }
+                else if (state == 1)
+                {
+                    t = (*pc)++;
+                    p->start[t].opcode = Jmp;
+                    p->start[f->t].y = *pc;
+                    f->t = t;
+                    child = r->right;
+                }
+                else
+                {
+                    p->start[f->t].x = *pc;
+                    n--;
+                    continue;
+                }
+                break;
+
+            case Cat:
+                if (state == 2)
+                {
+                    n--;
+                    continue;
+                }
+                child = state == 0 ? r->left : r->right;
+                break;
+
+            case Quest:
+                if (state == 0)
+                {
+                    f->t = (*pc)++;
+                    i1 = p->start + f->t;
+                    i1->opcode = Split;
+                    i1->x = *pc;
+                    child = r->left;
+                    break;
+                }
+                i1 = p->start + f->t;
+                i1->y = *pc;
+                if(r->n)
+                {
+                    /* Non-greedy */
+                    t = i1->x;
+                    i1->x = i1->y;
+                    i1->y = t;
+                }
+                n--;
+                continue;
+
+            case Star:
+                if (state == 0)
+                {
+                    f->t = (*pc)++;
+                    i1 = p->start + f->t;
+                    i1->opcode = Split;
+                    i1->x = *pc;
+                    child = r->left;
+                    break;
+                }
+                i1 = p->start + (*pc)++;
+                i1->opcode = Jmp;
+                i1->x = f->t;
+                i1 = p->start + f->t;
+                i1->y = *pc;
+                if(r->n)
+                {
+                    t = i1->x;
+                    i1->x = i1->y;
+                    i1->y = t;
+                }
+                n--;
+                continue;
+
+            case Plus:
+                if (state == 0)
+                {
+                    f->t = *pc;
+                    child = r->left;
+                    break;
+                }
+                i1 = p->start + (*pc)++;
+                i1->opcode = Split;
+                i1->x = f->t;
+                i1->y = *pc;
+                if(r->n)
+                {
+                    t = i1->x;
+                    i1->x = i1->y;
+                    i1->y = t;
+                }
+                n--;
+                continue;
+
+            case Paren:
+                i1 = p->start + (*pc)++;
+                i1->opcode = Save;
+                i1->n = 2*r->n + state;
+                if (state == 1)
+                {
+                    n--;
+                    continue;
+                }
+                child = r->left;
+                break;
 
-        case Plus:
-            p1 = *pc;
-            emit(r->left, pc);
-            (*pc)->opcode = Split;
-            (*pc)->x = p1;
-            p2 = *pc;
-            (*pc)++;
-            p2->y = *pc;
-            if(r->n)
+            case Count:
+                t = (*pc)++;
+                p->start[t].opcode = Repeat;
+                p->start[t].y = tableused(p, t, Repeat);
+                PROGREPEAT(p, p->start[t].y)->lo = r->lo;
+                PROGREPEAT(p, p->start[t].y)->hi = r->hi;
+                p->start[t].n = emitbody(r->left, p, pc, arena);
+                p->start[t].x = *pc;
+                n--;
+                continue;
+        }
+        STACKROOM(arena, s, n, max, 1);
+        s[n].r = child;
+        s[n].state = 0;
+        n++;
+    }
+}
+
+/* Emit the body of a Count node: every single character matcher of the
+ * concatenation gets its own position, alternatives share theirs.
+ * Returns the number of positions.
+ */
+static int
+emitbody(Regexp *r, Prog *p, int *pc, Arena *arena)
+{
+    Walk buf[STACKINIT], *s = buf;
+    int n, max = STACKINIT, pos = 0, alt, i;
+
+    s[0].r = r;
+    s[0].state = 0;
+    for (n = 1; n > 0; )
+    {
+        r = s[--n].r;
+        alt = s[n].state;
+        if (r == NULL)
+        {
+            /* End of an alternation */
+            pos++;
+            continue;
+        }
+        STACKROOM(arena, s, n, max, 3);
+        if (r->type == Cat && !alt)
+        {
+            s[n].r = r->right;
+            s[n++].state = 0;
+            s[n].r = r->left;
+            s[n++].state = 0;
+        }
+        else if (r->type == Alt)
+        {
+            if (!alt)
             {
-                t = p2->x;
-                p2->x = p2->y;
-                p2->y = t;
+                s[n].r = NULL;
+                s[n++].state = 0;
             }
-            break;
-
-        case Paren:
-            (*pc)->opcode = Save;
-            (*pc)->n = 2*r->n;
-            (*pc)++;
-            emit(r->left, pc);
-            (*pc)->opcode = Save;
-            (*pc)->n = 2*r->n + 1;
-            (*pc)++;
-            break;
+            s[n].r = r->right;
+            s[n++].state = 1;
+            s[n].r = r->left;
+            s[n++].state = 1;
+        }
+        else if (r->type == Str && !alt)
+        {
+            for (i = 0; i < r->n; i++)
+            {
+                p->start[*pc].opcode = Char;
+                p->start[*pc].c = r->str[i];
+                p->start[*pc].n = pos++;
+                (*pc)++;
+            }
+        }
+        else
+        {
+            emitleaf(r, p, pc);
+            p->start[*pc - 1].n = pos;
+            if (!alt)
+                pos++;
+        }
     }
+    return pos;
 }
 
 #if !defined(NDEBUG) && defined(UREG_TRACE)
@@ -194,10 +825,10 @@ printprog(Prog *p)
                 fatal("bad opcode (PUPPA/4!)");
                 break;
             case Split:
-                printf("%2d. split %d, %d\n", (int)(pc-p->start), (int)(pc->x-p->start), (int)(pc->y-p->start));
+                printf("%2d. split %d, %d\n", (int)(pc-p->start), pc->x, pc->y);
                 break;
             case Jmp:
-                printf("%2d. jmp %d\n", (int)(pc-p->start), (int)(pc->x-p->start));
+                printf("%2d. jmp %d\n", (int)(pc-p->start), pc->x);
                 break;
             case Char:
                 printf("%2d. char '%c'\n", (int)(pc-p->start), pc->c);
@@ -208,11 +839,23 @@ printprog(Prog *p)
             case Any:
                 printf("%2d. any\n", (int)(pc-p->start));
                 break;
+            case Set:
+                printf("%2d. set %d\n", (int)(pc-p->start), pc->y);
+                break;
+            case String:
+                printf("%2d. string \"%.*s\"\n", (int)(pc-p->start), pc->n, PROGSTR(p) + pc->y);
+                break;
             case Match:
                 printf("%2d. match\n", (int)(pc-p->start));
                 break;
             case Save:
                 printf("%2d. save %d\n", (int)(pc-p->start), pc->n);
+                break;
+            case Repeat:
+                printf("%2d. repeat {%d,%d} width %d, next %d\n",
+                       (int)(pc-p->start), PROGREPEAT(p, pc->y)->lo,
+                       PROGREPEAT(p, pc->y)->hi, pc->n, pc->x);
+                break;
         }
     }
 }
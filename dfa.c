@@ -0,0 +1,347 @@
+/* dfa.c - subset construction of a deterministic automaton
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+/* Construction state. DFA states are identified by the sorted set of
+ * consuming instructions (plus Match) in their epsilon closure; sets are
+ * stored back to back in a single pool.
+ */
+typedef struct DfaBuilder DfaBuilder;
+struct DfaBuilder
+{
+    Prog *prog;
+    const ureg_allocator *alloc;
+    int maxstate;
+    int nstate;
+    /* Pool of state sets and offset/length of every state's set */
+    int *pool;
+    int npool, cappool;
+    int *setoff;
+    int *setlen;
+    /* Open addressing hash table of state ids, size is a power of 2 */
+    int *hash;
+    int nhash;
+    /* Scratch used while computing epsilon closures */
+    int *stack;
+    int *mark;
+    int gen;
+    int *set;
+    /* Byte classes: bytes with the same class behave identically */
+    int classof[256];
+    int nclass;
+    int classrep[256];
+};
+
+/* Does consuming instruction pc accept byte b? Mirrors thompsonvm(). */
+static int
+accepts(Prog *p, Inst *pc, int b)
+{
+    char c = (char)b;
+
+    switch (pc->opcode)
+    {
+        case Char:
+            return c == pc->c;
+        case Rng:
+            if (c < pc->lo || c > pc->hi)
+                return 0;
+            return c != '\0';
+        case Any:
+            return c != '\0';
+        case Set:
+            return CLASSHAS(PROGCLASS(p, pc->y), b) != 0;
+    }
+    return 0;
+}
+
+static int
+intcmp(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Compute the epsilon closure of the n seeds in b->stack into b->set.
+ * Returns the size of the resulting set, sorted by instruction index.
+ */
+static int
+closure(DfaBuilder *b, int n)
+{
+    Inst *start = b->prog->start;
+    Inst *pc;
+    int i, nset = 0;
+
+    b->gen++;
+    while (n > 0)
+    {
+        i = b->stack[--n];
+        if (b->mark[i] == b->gen)
+            continue;
+        b->mark[i] = b->gen;
+        pc = start + i;
+        switch (pc->opcode)
+        {
+            case Jmp:
+                b->stack[n++] = pc->x;
+                break;
+            case Split:
+                b->stack[n++] = pc->y;
+                b->stack[n++] = pc->x;
+                break;
+            case Save:
+                b->stack[n++] = i + 1;
+                break;
+            default:
+                b->set[nset++] = i;
+                break;
+        }
+    }
+    qsort(b->set, nset, sizeof(b->set[0]), intcmp);
+    return nset;
+}
+
+static unsigned int
+sethash(const int *set, int n)
+{
+    unsigned int h = 2166136261U;
+    int i;
+
+    for (i = 0; i < n; i++)
+        h = (h ^ (unsigned int)set[i]) * 16777619U;
+    return h;
+}
+
+/* Returned by lookup() when no state can be added, unlike DfaDead */
+#define DFA_FULL    (-3)
+
+/* Find the state for b->set, adding it if necessary. Returns DFA_FULL
+ * when the state limit has been hit or memory is exhausted.
+ */
+static int
+lookup(DfaBuilder *b, int n)
+{
+    unsigned int h;
+    int id, *p;
+
+    h = sethash(b->set, n) & (b->nhash - 1);
+    for (; (id = b->hash[h]) >= 0; h = (h + 1) & (b->nhash - 1))
+    {
+        if (b->setlen[id] == n &&
+            memcmp(b->pool + b->setoff[id], b->set, n*sizeof(int)) == 0)
+            return id;
+    }
+    if (b->nstate >= b->maxstate)
+        return DFA_FULL;
+    if (b->npool + n > b->cappool)
+    {
+        p = (int *)urealloc(b->alloc, b->pool, b->npool*sizeof(int),
+                            2*(b->npool + n)*sizeof(int));
+        if (p == NULL)
+            return DFA_FULL;
+        b->cappool = 2*(b->npool + n);
+        b->pool = p;
+    }
+    id = b->nstate++;
+    memcpy(b->pool + b->npool, b->set, n*sizeof(int));
+    b->setoff[id] = b->npool;
+    b->setlen[id] = n;
+    b->npool += n;
+    b->hash[h] = id;
+    return id;
+}
+
+/* Split the byte space into runs of bytes no instruction can tell apart */
+static void
+byteclasses(DfaBuilder *b)
+{
+    Prog *p = b->prog;
+    int c, i, same;
+
+    b->nclass = 0;
+    for (c = 0; c < 256; c++)
+    {
+        same = c > 0;
+        for (i = 0; same && i < p->len; i++)
+            if (accepts(p, p->start + i, c) != accepts(p, p->start + i, c - 1))
+                same = 0;
+        if (!same)
+            b->classrep[b->nclass++] = c;
+        b->classof[c] = b->nclass - 1;
+    }
+}
+
+/* Classify a closure: DfaMatch if it contains Match, DfaDead if empty */
+static int
+settarget(DfaBuilder *b, int n)
+{
+    int i;
+
+    if (n == 0)
+        return DfaDead;
+    for (i = 0; i < n; i++)
+        if (b->prog->start[b->set[i]].opcode == Match)
+            return DfaMatch;
+    return lookup(b, n);
+}
+
+/* Copy of p with every String replaced by a chain of Char instructions,
+ * since states are sets of instructions. Returns p itself if it has no
+ * literals.
+ */
+Prog*
+expandstrings(Prog *p, const ureg_allocator *alloc)
+{
+    Prog *q;
+    Inst *pc;
+    int *map;
+    int i, k, len;
+
+    if (p->nstr == 0)
+        return p;
+    map = (int *)ualloc(alloc, p->len*sizeof(int));
+    if (map == NULL)
+        return NULL;
+    for (i = 0, len = 0; i < p->len; i++)
+    {
+        map[i] = len;
+        len += p->start[i].opcode == String ? p->start[i].n : 1;
+    }
+    /* Callers make sure there are no Repeat instructions */
+    q = (Prog *)ualloc(alloc, PROGSIZE(len, 0, 0, 0, p->nclass));
+    if (q != NULL)
+    {
+        q->len = len;
+        q->ncount = p->ncount;
+        q->nrepeat = 0;
+        q->nclosure = 0;
+        q->nstr = 0;
+        q->nclass = p->nclass;
+        memcpy(PROGCLASS(q, 0), PROGCLASS(p, 0), (size_t)p->nclass*CLASSBYTES);
+        for (i = 0; i < p->len; i++)
+        {
+            pc = q->start + map[i];
+            if (p->start[i].opcode != String)
+            {
+                *pc = p->start[i];
+                if (pc->opcode == Jmp || pc->opcode == Split)
+                {
+                    pc->x = map[pc->x];
+                    pc->y = map[pc->y];
+                }
+                continue;
+            }
+            for (k = 0; k < p->start[i].n; k++, pc++)
+            {
+                memset(pc, '\0', sizeof(*pc));
+                pc->opcode = Char;
+                pc->c = PROGSTR(p)[p->start[i].y + k];
+            }
+        }
+    }
+    ufree(alloc, map);
+    return q;
+}
+
+/* Build a DFA equivalent to p with at most maxstate states.
+ * Returns NULL if the automaton would be bigger than that.
+ */
+Dfa*
+dfabuild(Prog *p, int maxstate, const ureg_allocator *alloc)
+{
+    DfaBuilder b;
+    Dfa *d = NULL;
+    Prog *orig;
+    int *row, *tmp;
+    int i, k, c, s, n, t, ok = 0;
+
+    /* Counters have no finite representation here, see expand_counts() */
+    if (p->ncount > 0)
+        return NULL;
+    if ((p = expandstrings(orig = p, alloc)) == NULL)
+        return NULL;
+    memset(&b, '\0', sizeof(b));
+    b.prog = p;
+    b.alloc = alloc;
+    b.maxstate = maxstate;
+    for (b.nhash = 16; b.nhash < 2*maxstate; b.nhash *= 2)
+        ;
+    b.setoff = (int *)ualloc(alloc, maxstate*sizeof(int));
+    b.setlen = (int *)ualloc(alloc, maxstate*sizeof(int));
+    b.hash = (int *)ualloc(alloc, b.nhash*sizeof(int));
+    b.stack = (int *)ualloc(alloc, 3*p->len*sizeof(int));
+    b.mark = (int *)ucalloc(alloc, p->len*sizeof(int));
+    b.set = (int *)ualloc(alloc, p->len*sizeof(int));
+    /* Per-class transitions of every state, expanded at the end */
+    tmp = (int *)ualloc(alloc, maxstate*256*sizeof(int));
+    if (b.setoff == NULL || b.setlen == NULL || b.hash == NULL ||
+        b.stack == NULL || b.mark == NULL || b.set == NULL || tmp == NULL)
+        goto out;
+    for (i = 0; i < b.nhash; i++)
+        b.hash[i] = -1;
+    byteclasses(&b);
+
+    b.stack[0] = 0;
+    n = closure(&b, 1);
+    if ((t = settarget(&b, n)) == DFA_FULL)
+        goto out;
+
+    /* States are numbered in discovery order, so walking ids in order
+     * is a breadth-first visit of the automaton.
+     */
+    for (s = 0; s < b.nstate; s++)
+    {
+        row = tmp + s*256;
+        for (c = 0; c < b.nclass; c++)
+        {
+            /* End of input never leads anywhere */
+            if (b.classrep[c] == 0)
+            {
+                row[c] = DfaDead;
+                continue;
+            }
+            k = 0;
+            for (i = 0; i < b.setlen[s]; i++)
+            {
+                int pc = b.pool[b.setoff[s] + i];
+                if (accepts(p, p->start + pc, b.classrep[c]))
+                    b.stack[k++] = pc + 1;
+            }
+            n = closure(&b, k);
+            if ((row[c] = settarget(&b, n)) == DFA_FULL)
+                goto out;
+        }
+    }
+
+    /* The start state may be DfaMatch, leaving no states at all */
+    d = (Dfa *)ualloc(alloc, sizeof(Dfa) + (b.nstate*256)*sizeof(int));
+    if (d == NULL)
+        goto out;
+    d->nstate = b.nstate;
+    d->start = t;
+    for (s = 0; s < b.nstate; s++)
+        for (c = 0; c < 256; c++)
+            d->trans[s*256 + c] = tmp[s*256 + b.classof[c]];
+    ok = 1;
+
+out:
+    ufree(alloc, b.pool);
+    ufree(alloc, b.setoff);
+    ufree(alloc, b.setlen);
+    ufree(alloc, b.hash);
+    ufree(alloc, b.stack);
+    ufree(alloc, b.mark);
+    ufree(alloc, b.set);
+    ufree(alloc, tmp);
+    if (p != orig)
+        ufree(alloc, p);
+    if (!ok)
+        return NULL;
+    return d;
+}
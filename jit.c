@@ -0,0 +1,337 @@
+/* jit.c - x86-64 native code generation
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * The program is first turned into a DFA (see dfa.c), then every DFA
+ * state becomes a small block of code which loads the next input byte
+ * and walks a chain of compares over the byte ranges leading to each
+ * successor state:
+ *
+ *      state_N:
+ *          movzx   eax, byte [rdi]
+ *          add     rdi, 1
+ *          cmp     eax, <hi of 1st range>
+ *          jbe     <state for 1st range>
+ *          ...
+ *          jmp     <state for last range>
+ *
+ * The generated function follows the System V calling convention and
+ * has the prototype int f(const char *input).
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+#if defined(UREG_JIT_X86_64) && (defined(__x86_64__) || defined(__amd64__))
+#define UREG_HAVE_JIT 1
+#endif
+
+#ifdef UREG_HAVE_JIT
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Maximum number of DFA states turned into native code */
+#define JIT_MAXSTATE    1024
+
+struct Jit
+{
+    void *code;
+    size_t size;
+    int (*fn)(const char *);
+};
+
+/* Code buffer and pending rel32 fixups */
+typedef struct Emitter Emitter;
+struct Emitter
+{
+    const ureg_allocator *alloc;
+    unsigned char *buf;
+    size_t len, cap;
+    /* Fixups: offset of the rel32 field and target label */
+    size_t *fixpos;
+    int *fixlabel;
+    int nfix, capfix;
+    int failed;
+};
+
+/* Labels past the DFA states */
+#define LABEL_MATCH(d)  ((d)->nstate)
+#define LABEL_DEAD(d)   ((d)->nstate + 1)
+
+static void
+emitbytes(Emitter *e, const unsigned char *b, size_t n)
+{
+    unsigned char *nb;
+
+    if (e->failed)
+        return;
+    if (e->len + n > e->cap)
+    {
+        nb = (unsigned char *)urealloc(e->alloc, e->buf, e->len, 2*(e->len + n));
+        if (nb == NULL)
+        {
+            e->failed = 1;
+            return;
+        }
+        e->cap = 2*(e->len + n);
+        e->buf = nb;
+    }
+    memcpy(e->buf + e->len, b, n);
+    e->len += n;
+}
+
+static void
+emit32(Emitter *e, unsigned int v)
+{
+    unsigned char b[4];
+
+    b[0] = v & 0xff;
+    b[1] = (v >> 8) & 0xff;
+    b[2] = (v >> 16) & 0xff;
+    b[3] = (v >> 24) & 0xff;
+    emitbytes(e, b, 4);
+}
+
+/* Emit a rel32 reference to label, resolved by patch() */
+static void
+emitlabel(Emitter *e, int label)
+{
+    size_t *np;
+    int *nl;
+
+    if (e->failed)
+        return;
+    if (e->nfix == e->capfix)
+    {
+        int cap = e->capfix ? 2*e->capfix : 64;
+
+        np = (size_t *)urealloc(e->alloc, e->fixpos, e->nfix*sizeof(size_t), cap*sizeof(size_t));
+        if (np != NULL)
+            e->fixpos = np;
+        nl = (int *)urealloc(e->alloc, e->fixlabel, e->nfix*sizeof(int), cap*sizeof(int));
+        if (nl != NULL)
+            e->fixlabel = nl;
+        if (np == NULL || nl == NULL)
+        {
+            e->failed = 1;
+            return;
+        }
+        e->capfix = cap;
+    }
+    e->fixpos[e->nfix] = e->len;
+    e->fixlabel[e->nfix] = label;
+    e->nfix++;
+    emit32(e, 0);
+}
+
+static int
+labelof(Dfa *d, int target)
+{
+    if (target == DfaMatch)
+        return LABEL_MATCH(d);
+    if (target == DfaDead)
+        return LABEL_DEAD(d);
+    return target;
+}
+
+static void
+emitstate(Emitter *e, Dfa *d, int s)
+{
+    static const unsigned char load[] = {
+        0x0f, 0xb6, 0x07,           /* movzx eax, byte [rdi] */
+        0x48, 0x83, 0xc7, 0x01      /* add rdi, 1 */
+    };
+    unsigned char op[2];
+    int *row = d->trans + s*256;
+    int c, hi;
+
+    emitbytes(e, load, sizeof(load));
+    for (c = 0; c < 256; c = hi + 1)
+    {
+        for (hi = c; hi < 255 && row[hi + 1] == row[c]; hi++)
+            ;
+        if (hi == 255)
+        {
+            op[0] = 0xe9;           /* jmp rel32 */
+            emitbytes(e, op, 1);
+        }
+        else
+        {
+            if (hi < 0x80)
+            {
+                op[0] = 0x83;       /* cmp eax, imm8 */
+                op[1] = 0xf8;
+                emitbytes(e, op, 2);
+                op[0] = (unsigned char)hi;
+                emitbytes(e, op, 1);
+            }
+            else
+            {
+                op[0] = 0x3d;       /* cmp eax, imm32 */
+                emitbytes(e, op, 1);
+                emit32(e, (unsigned int)hi);
+            }
+            op[0] = 0x0f;           /* jbe rel32 */
+            op[1] = 0x86;
+            emitbytes(e, op, 2);
+        }
+        emitlabel(e, labelof(d, row[c]));
+    }
+}
+
+/* Append an entry to /tmp/perf-<pid>.map for the code at j */
+static void
+perfmap(Jit *j, const char *name)
+{
+    char path[64];
+    FILE *f;
+    const char *p;
+
+    sprintf(path, "/tmp/perf-%ld.map", (long)getpid());
+    if ((f = fopen(path, "a")) == NULL)
+        return;
+    fprintf(f, "%lx %lx ureg:", (unsigned long)j->code, (unsigned long)j->size);
+    for (p = name; p && *p; p++)
+        fputc((*p == '\n' || *p == '\r') ? ' ' : *p, f);
+    fputc('\n', f);
+    fclose(f);
+}
+
+/* Translate a program into native code.
+ * Returns NULL if the program is not suitable (DFA too big) or on error,
+ * callers are expected to fall back on the interpreter.
+ */
+Jit*
+jitcompile(Prog *p, const char *name, int wantperfmap, const ureg_allocator *alloc)
+{
+    static const unsigned char match[] = {
+        0xb8, 0x01, 0x00, 0x00, 0x00,   /* mov eax, 1 */
+        0xc3                            /* ret */
+    };
+    static const unsigned char dead[] = {
+        0x31, 0xc0,                     /* xor eax, eax */
+        0xc3                            /* ret */
+    };
+    Emitter e;
+    Dfa *d;
+    Jit *j = NULL;
+    size_t *labels = NULL;
+    void *code;
+    int s, i;
+    long rel;
+
+    if ((d = dfabuild(p, JIT_MAXSTATE, alloc)) == NULL)
+        return NULL;
+    memset(&e, '\0', sizeof(e));
+    e.alloc = alloc;
+    labels = (size_t *)ualloc(alloc, (d->nstate + 2)*sizeof(size_t));
+    if (labels == NULL)
+        goto out;
+
+    /* The start state is always state 0 when it is not an immediate match */
+    for (s = 0; s < d->nstate; s++)
+    {
+        labels[s] = e.len;
+        emitstate(&e, d, s);
+    }
+    labels[LABEL_DEAD(d)] = e.len;
+    emitbytes(&e, dead, sizeof(dead));
+    labels[LABEL_MATCH(d)] = e.len;
+    emitbytes(&e, match, sizeof(match));
+    if (e.failed)
+        goto out;
+
+    for (i = 0; i < e.nfix; i++)
+    {
+        rel = (long)labels[e.fixlabel[i]] - (long)(e.fixpos[i] + 4);
+        e.buf[e.fixpos[i]] = rel & 0xff;
+        e.buf[e.fixpos[i] + 1] = (rel >> 8) & 0xff;
+        e.buf[e.fixpos[i] + 2] = (rel >> 16) & 0xff;
+        e.buf[e.fixpos[i] + 3] = (rel >> 24) & 0xff;
+    }
+
+    if ((j = (Jit *)ualloc(alloc, sizeof(Jit))) == NULL)
+        goto out;
+    j->size = e.len;
+    code = mmap(NULL, j->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        ufree(alloc, j);
+        j = NULL;
+        goto out;
+    }
+    memcpy(code, e.buf, e.len);
+    if (mprotect(code, j->size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, j->size);
+        ufree(alloc, j);
+        j = NULL;
+        goto out;
+    }
+    j->code = code;
+    /* Entry point: state 0, or straight to the match stub */
+    if (d->start == DfaMatch)
+        code = (char *)code + labels[LABEL_MATCH(d)];
+    *(void **)(&j->fn) = code;
+    if (wantperfmap)
+        perfmap(j, name);
+
+out:
+    ufree(alloc, labels);
+    ufree(alloc, e.buf);
+    ufree(alloc, e.fixpos);
+    ufree(alloc, e.fixlabel);
+    ufree(alloc, d);
+    return j;
+}
+
+int
+jitexec(Jit *j, const char *input)
+{
+    return j->fn(input);
+}
+
+void
+jitfree(Jit *j, const ureg_allocator *alloc)
+{
+    if (j == NULL)
+        return;
+    munmap(j->code, j->size);
+    ufree(alloc, j);
+}
+
+#else /* !UREG_HAVE_JIT */
+
+/* No native code generator for this platform, always use the interpreter */
+Jit*
+jitcompile(Prog *p, const char *name, int wantperfmap, const ureg_allocator *alloc)
+{
+    UNUSED_PARAMETER(p);
+    UNUSED_PARAMETER(alloc);
+    UNUSED_PARAMETER(name);
+    UNUSED_PARAMETER(wantperfmap);
+    return NULL;
+}
+
+int
+jitexec(Jit *j, const char *input)
+{
+    UNUSED_PARAMETER(j);
+    UNUSED_PARAMETER(input);
+    return -1;
+}
+
+void
+jitfree(Jit *j, const ureg_allocator *alloc)
+{
+    UNUSED_PARAMETER(j);
+    UNUSED_PARAMETER(alloc);
+}
+
+#endif /* UREG_HAVE_JIT */
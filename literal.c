@@ -0,0 +1,427 @@
+/* literal.c - substring search for literal patterns
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * Patterns made only of literal bytes, or of a few such strings joined
+ * by '|', need no automaton at all: they are searched for with the
+ * Two-Way algorithm of Crochemore and Perrin, which runs in linear time
+ * and constant space. Each string is cut at its critical factorization
+ * when the searcher is built; a search then compares the right part
+ * forwards and the left part backwards, shifting by the period or by
+ * the number of bytes matched. While nothing of the right part matches
+ * the search skips ahead with memchr() to the next occurrence of its
+ * first byte, which C libraries are quick at.
+ *
+ * Alternatives are searched for one after the other, each one only up
+ * to the leftmost match found so far, so the search stays linear in the
+ * input for a bounded number of them (UREG_LITERAL_MAXALT).
+ *
+ * Two strings with any bytes in between ("foo.*bar", "foo.{2,8}bar")
+ * are searched for in turn: the first one gives where the match may
+ * start, the second one is looked for where the gap allows. As later
+ * occurrences of the first string only move the bound further, the
+ * search for the second string never goes back.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+/* A string to search for, with its critical factorization: the right
+ * part starts at ell + 1, per is its period (or a shift which is safe
+ * for non periodic strings)
+ */
+typedef struct LitString LitString;
+struct LitString
+{
+    const unsigned char *s;
+    long len;
+    long ell;
+    long per;
+    int periodic;
+};
+
+struct Literal
+{
+    int anchored;
+    /* Two strings with mingap to maxgap (-1 for no limit) bytes in
+     * between, or alternatives
+     */
+    int gap;
+    long mingap, maxgap;
+    int nlit;
+    LitString lit[1];
+};
+
+/* Is c just itself outside brackets? See parse(). */
+static int
+plainbyte(char c)
+{
+    return strchr("\\[](){}|*+?.", c) == NULL;
+}
+
+/* Maximal suffix of x for the byte order (rev = 0) or its reverse.
+ * Returns the index before its start and its period in *p.
+ */
+static long
+maxsuffix(const unsigned char *x, long m, long *p, int rev)
+{
+    long ms = -1, j = 0, k = 1;
+    unsigned char a, b;
+
+    *p = 1;
+    while (j + k < m)
+    {
+        a = x[j + k];
+        b = x[ms + k];
+        if (rev ? a > b : a < b)
+        {
+            j += k;
+            k = 1;
+            *p = j - ms;
+        }
+        else if (a == b)
+        {
+            if (k != *p)
+                k++;
+            else
+            {
+                j += *p;
+                k = 1;
+            }
+        }
+        else
+        {
+            ms = j;
+            j = ms + 1;
+            k = *p = 1;
+        }
+    }
+    return ms;
+}
+
+static void
+factorize(LitString *l)
+{
+    long i, j, p, q;
+
+    i = maxsuffix(l->s, l->len, &p, 0);
+    j = maxsuffix(l->s, l->len, &q, 1);
+    l->ell = i > j ? i : j;
+    l->per = i > j ? p : q;
+    l->periodic = l->ell + 1 <= l->len - l->per &&
+                  memcmp(l->s, l->s + l->per, (size_t)l->ell + 1) == 0;
+    if (!l->periodic)
+        l->per = (l->ell + 1 > l->len - l->ell - 1 ? l->ell + 1 : l->len - l->ell - 1) + 1;
+}
+
+/* Length of the run of literal bytes at c, copied to buf unless NULL.
+ * *end gets where the run stops.
+ */
+static long
+litrun(const char *c, unsigned char *buf, const char **end)
+{
+    long n;
+
+    for (n = 0; *c != '\0'; c++, n++)
+    {
+        if (*c == '\\' && c[1] != '\0')
+            c++;
+        else if (!plainbyte(*c))
+            break;
+        if (buf != NULL)
+            buf[n] = (unsigned char)*c;
+    }
+    *end = c;
+    return n;
+}
+
+/* Parse a gap of any bytes at c: '.' followed by '*', '+' or a counted
+ * repetition. Returns 0 if there is none there.
+ */
+static int
+gapspec(const char *c, long *min, long *max, const char **end)
+{
+    char *e;
+
+    if (*c++ != '.')
+        return 0;
+    switch (*c)
+    {
+        case '*':
+            *min = 0;
+            *max = -1;
+            break;
+        case '+':
+            *min = 1;
+            *max = -1;
+            break;
+        case '{':
+            /* The parser has already checked the numbers */
+            *min = *max = strtol(c + 1, &e, 10);
+            if (e == c + 1)
+                return 0;
+            if (*e == ',')
+            {
+                c = e + 1;
+                *max = *c == '}' ? -1 : strtol(c, &e, 10);
+                if (*max < 0)
+                    e = (char *)c;
+            }
+            if (*e != '}')
+                return 0;
+            c = e;
+            break;
+        default:
+            return 0;
+    }
+    *end = c + 1;
+    return 1;
+}
+
+/* Build a searcher for pattern, NULL if it is not literal (or on
+ * failure, the other engines being able to run it anyway)
+ */
+Literal*
+literalbuild(const char *pattern, unsigned int flags, const ureg_allocator *alloc)
+{
+    Literal *l;
+    unsigned char *text;
+    const char *c;
+    long n, min = 0, max = -1;
+    size_t nbytes;
+    int nlit = 1, gap = 0, i;
+
+    /* Strings must not be empty. Anything after the second string of
+     * a gap, like a non-greedy '?', is left to the automata.
+     */
+    if ((n = litrun(pattern, NULL, &c)) == 0)
+        return NULL;
+    nbytes = (size_t)n;
+    if (gapspec(c, &min, &max, &c))
+    {
+        if ((n = litrun(c, NULL, &c)) == 0)
+            return NULL;
+        nbytes += (size_t)n;
+        nlit = 2;
+        gap = 1;
+    }
+    else
+    {
+        while (*c == '|')
+        {
+            if (++nlit > UREG_LITERAL_MAXALT || (n = litrun(c + 1, NULL, &c)) == 0)
+                return NULL;
+            nbytes += (size_t)n;
+        }
+    }
+    if (*c != '\0')
+        return NULL;
+
+    l = (Literal *)ualloc(alloc, sizeof(Literal) + (size_t)(nlit - 1)*sizeof(LitString) + nbytes);
+    if (l == NULL)
+        return NULL;
+    l->anchored = (flags & UREG_ANCHORED) != 0;
+    l->gap = gap;
+    l->mingap = min;
+    l->maxgap = max;
+    l->nlit = nlit;
+    text = (unsigned char *)(l->lit + nlit);
+    for (c = pattern, i = 0; i < nlit; i++)
+    {
+        l->lit[i].s = text;
+        l->lit[i].len = litrun(c, text, &c);
+        text += l->lit[i].len;
+        factorize(&l->lit[i]);
+        /* Step over the separator */
+        if (*c == '|')
+            c++;
+        else if (*c == '.')
+            gapspec(c, &min, &max, &c);
+    }
+    return l;
+}
+
+/* Searcher for the n bytes at str alone, for other engines to look for
+ * a string the pattern needs
+ */
+Literal*
+literalstring(const char *str, long n, const ureg_allocator *alloc)
+{
+    Literal *l;
+
+    if ((l = (Literal *)ualloc(alloc, sizeof(Literal) + (size_t)n)) == NULL)
+        return NULL;
+    memset(l, '\0', sizeof(Literal));
+    l->nlit = 1;
+    l->maxgap = -1;
+    memcpy(l->lit + 1, str, (size_t)n);
+    l->lit[0].s = (unsigned char *)(l->lit + 1);
+    l->lit[0].len = n;
+    factorize(&l->lit[0]);
+    return l;
+}
+
+/* First occurrence of l in the n bytes at y, -1 if none */
+static long
+twoway(const LitString *l, const unsigned char *y, long n)
+{
+    const unsigned char *x = l->s, *f;
+    long m = l->len, ell = l->ell, i, j = 0, memory = -1;
+
+    while (j <= n - m)
+    {
+        /* Nothing remembered: go to where the right part may start */
+        if (memory < 0)
+        {
+            f = (const unsigned char *)memchr(y + j + ell + 1, x[ell + 1], (size_t)(n - m - j + 1));
+            if (f == NULL)
+                return -1;
+            j = (long)(f - y) - ell - 1;
+        }
+        i = (ell > memory ? ell : memory) + 1;
+        while (i < m && x[i] == y[i + j])
+            i++;
+        if (i < m)
+        {
+            j += i - ell;
+            memory = -1;
+            continue;
+        }
+        i = ell;
+        while (i > memory && x[i] == y[i + j])
+            i--;
+        if (i <= memory)
+            return j;
+        j += l->per;
+        /* A shift by the period keeps the prefix which overlaps */
+        memory = l->periodic ? m - l->per - 1 : -1;
+    }
+    return -1;
+}
+
+/* Leftmost-first match of alternatives in the n bytes at y (n is not
+ * needed for anchored searches): returns where it starts, -1 if none,
+ * and where it ends in *end if all is set (any match will do otherwise)
+ */
+static long
+altsearch(Literal *l, const unsigned char *y, long n, int all, long *end)
+{
+    long pos, best = -1;
+    int i;
+
+    for (i = 0; i < l->nlit; i++)
+    {
+        if (l->anchored)
+            pos = strncmp((const char *)y, (const char *)l->lit[i].s, (size_t)l->lit[i].len) == 0 ? 0 : -1;
+        else
+            /* Later alternatives have to start before the best match */
+            pos = twoway(&l->lit[i], y, best < 0 || best - 1 + l->lit[i].len > n ? n :
+                                        best - 1 + l->lit[i].len);
+        if (pos >= 0)
+        {
+            best = pos;
+            *end = pos + l->lit[i].len;
+            if (!all || pos == 0)
+                break;
+        }
+    }
+    return best;
+}
+
+/* Leftmost-first match of a gap in the n bytes at y, same results as
+ * altsearch(). The gap is greedy: the match ends with the last
+ * occurrence of the second string in reach.
+ */
+static long
+gapsearch(Literal *l, const unsigned char *y, long n, int all, long *end)
+{
+    const LitString *a = &l->lit[0], *b = &l->lit[1];
+    long i, j = -1, k, lo, hi, from = 0;
+
+    for (;;)
+    {
+        if (l->anchored)
+            i = from == 0 && a->len <= n && memcmp(y, a->s, (size_t)a->len) == 0 ? 0 : -1;
+        else if ((i = twoway(a, y + from, n - from)) >= 0)
+            i += from;
+        if (i < 0)
+            return -1;
+        /* Later starts only raise lo, which b has to be past */
+        lo = i + a->len + l->mingap;
+        if (lo > n - b->len)
+            return -1;
+        if (j < lo)
+        {
+            if ((j = twoway(b, y + lo, n - lo)) < 0)
+                return -1;
+            j += lo;
+        }
+        if (l->maxgap < 0 || j - lo <= l->maxgap - l->mingap)
+            break;
+        from = i + 1;
+    }
+    if (all)
+    {
+        hi = n - b->len;
+        if (l->maxgap >= 0 && i + a->len + l->maxgap < hi)
+            hi = i + a->len + l->maxgap;
+        while (j < hi && (k = twoway(b, y + j + 1, hi + b->len - j - 1)) >= 0)
+            j += k + 1;
+    }
+    *end = j + b->len;
+    return i;
+}
+
+/* Find the leftmost-first match of l in s. Returns 1 on match, with
+ * group 0 in caps and the other ncap - 1 groups unset.
+ */
+int
+literalexec(Literal *l, const char *s, int *caps, int ncap)
+{
+    const unsigned char *y = (const unsigned char *)s;
+    long n, start, end;
+    int i;
+
+    /* Anchored strings are compared in place */
+    n = l->anchored && !l->gap ? 0 : (long)strlen(s);
+    if (l->gap)
+        start = gapsearch(l, y, n, ncap > 0, &end);
+    else
+        start = altsearch(l, y, n, ncap > 0, &end);
+    if (start < 0)
+        return 0;
+    for (i = 0; i < 2*ncap; i++)
+        caps[i] = -1;
+    if (ncap > 0)
+    {
+        caps[0] = (int)start;
+        caps[1] = (int)end;
+    }
+    return 1;
+}
+
+/* First occurrence of the first string of l in the n bytes at s, -1 if
+ * none
+ */
+long
+literalfind(Literal *l, const char *s, long n)
+{
+    return twoway(&l->lit[0], (const unsigned char *)s, n);
+}
+
+/* Is l made of two strings with a gap in between? */
+int
+literalgap(const Literal *l)
+{
+    return l->gap;
+}
+
+void
+literalfree(Literal *l, const ureg_allocator *alloc)
+{
+    ufree(alloc, l);
+}
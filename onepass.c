@@ -0,0 +1,316 @@
+/* onepass.c - submatch extraction for one-pass programs
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * A program is one-pass when, wherever a match may be, the next input
+ * byte alone tells which instruction consumes it: a single thread is
+ * ever alive, and the Save instructions it goes through between two
+ * bytes can be worked out in advance. The table has a state for the
+ * start and for every instruction following a consuming one; for each
+ * byte class it gives the next state and the capture slots to set to
+ * the current position on the way, and a state which may match also
+ * gives the slots set on the way to Match. Programs for which a byte
+ * would lead to two instructions (or an instruction may be reached two
+ * ways) are rejected while the table is built.
+ *
+ * Priorities are those of the Pike VM (see pikevm()): a transition found
+ * before Match by the depth-first walk of a state is taken even if the
+ * state matches, the match being kept in case the rest fails, while one
+ * found after Match is never taken.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+/* Bigger programs are left to the other engines */
+#define ONEPASS_MAXSTATE    1024
+
+/* Actions are 4 words: next state (-1 for Match), whether it is taken
+ * when the state also matches, then offset and count of the slots it
+ * sets in the slot list.
+ */
+#define ACTIONWORDS         4
+
+struct OnePass
+{
+    int nstate;
+    /* Capture slots, two per group */
+    int nslot;
+    /* Runs of bytes no instruction tells apart */
+    int nclass;
+    int classof[256];
+    /* Per state: the match action, then one action per byte class (0 is
+     * no action)
+     */
+    int *trans;
+    int *action;
+    int *slots;
+};
+
+/* Does consuming instruction pc accept byte b? Mirrors thompsonvm(). */
+static int
+accepts(Prog *p, Inst *pc, int b)
+{
+    char c = (char)b;
+
+    switch (pc->opcode)
+    {
+        case Char:
+            return c == pc->c;
+        case Rng:
+            if (c < pc->lo || c > pc->hi)
+                return 0;
+            return c != '\0';
+        case Any:
+            return c != '\0';
+        case Set:
+            return CLASSHAS(PROGCLASS(p, pc->y), b) != 0;
+    }
+    return 0;
+}
+
+static int
+consumes(Inst *pc)
+{
+    return pc->opcode == Char || pc->opcode == Rng || pc->opcode == Any ||
+           pc->opcode == Set;
+}
+
+/* Append an action setting the n slots in path, returns its index */
+static int
+addaction(Arena *arena, int **action, int *naction, int *maxaction,
+          int **slots, int *nslots, int *maxslots, int next, int taken,
+          const int *path, int n)
+{
+    int *a;
+
+    STACKROOM(arena, *action, ACTIONWORDS*(*naction), *maxaction, ACTIONWORDS);
+    STACKROOM(arena, *slots, *nslots, *maxslots, n);
+    a = *action + ACTIONWORDS*(*naction);
+    a[0] = next;
+    a[1] = taken;
+    a[2] = *nslots;
+    a[3] = n;
+    memcpy(*slots + *nslots, path, (size_t)n*sizeof(int));
+    *nslots += n;
+    return (*naction)++;
+}
+
+/* Build the one-pass table of p, NULL if p is not one-pass or too big */
+OnePass*
+onepassbuild(Prog *p, const ureg_allocator *alloc)
+{
+    Arena arena;
+    jmp_buf oom;
+    OnePass *o = NULL;
+    Prog *orig;
+    Inst *pc;
+    int abuf[STACKINIT], sbuf[STACKINIT];
+    int *state, *entry, *mark, *stack, *path, *trans, *row, *action, *slots;
+    int naction, maxaction = STACKINIT, nslots = 0, maxslots = STACKINIT;
+    int nstate, nclass, nslot, classrep[256], classof[256];
+    int i, c, s, n, d, k, matched, same;
+    size_t size;
+
+    /* Counters would need a thread per count */
+    if (p->ncount > 0)
+        return NULL;
+    if ((p = expandstrings(orig = p, alloc)) == NULL)
+        return NULL;
+    arenainit(&arena, alloc, &oom);
+    /* Without memory there is no table, the other engines will do */
+    if (setjmp(oom))
+        goto out;
+    state = (int *)arenaalloc(&arena, p->len*sizeof(int));
+    entry = (int *)arenaalloc(&arena, p->len*sizeof(int));
+    mark = (int *)arenaalloc(&arena, p->len*sizeof(int));
+    path = (int *)arenaalloc(&arena, p->len*sizeof(int));
+    /* Only instructions seen for the first time push, at most two */
+    stack = (int *)arenaalloc(&arena, 2*(2*p->len + 1)*sizeof(int));
+
+    /* States, numbered in program order */
+    nslot = 0;
+    for (i = 0; i < p->len; i++)
+        state[i] = mark[i] = -1;
+    state[0] = 0;
+    entry[0] = 0;
+    nstate = 1;
+    for (i = 0; i < p->len; i++)
+    {
+        pc = p->start + i;
+        if (pc->opcode == Save && pc->n >= nslot)
+            nslot = pc->n + 1;
+        if (consumes(pc) && state[i + 1] < 0)
+        {
+            if (nstate == ONEPASS_MAXSTATE)
+                goto out;
+            state[i + 1] = nstate;
+            entry[nstate++] = i + 1;
+        }
+    }
+    nslot += nslot & 1;
+
+    nclass = 0;
+    for (c = 0; c < 256; c++)
+    {
+        same = c > 0;
+        for (i = 0; same && i < p->len; i++)
+            if (accepts(p, p->start + i, c) != accepts(p, p->start + i, c - 1))
+                same = 0;
+        if (!same)
+            classrep[nclass++] = c;
+        classof[c] = nclass - 1;
+    }
+
+    /* Arena memory comes zeroed: no actions yet */
+    trans = (int *)arenaalloc(&arena, (size_t)nstate*(nclass + 1)*sizeof(int));
+    action = abuf;
+    slots = sbuf;
+    /* Action 0 stands for none */
+    for (i = 0; i < ACTIONWORDS; i++)
+        abuf[i] = 0;
+    naction = 1;
+    for (s = 0; s < nstate; s++)
+    {
+        row = trans + s*(nclass + 1);
+        matched = 0;
+        /* Pairs of instruction and number of slots set on the way */
+        stack[0] = entry[s];
+        stack[1] = 0;
+        for (n = 2; n > 0; )
+        {
+            n -= 2;
+            i = stack[n];
+            d = stack[n + 1];
+            if (mark[i] == s)
+                goto out;
+            mark[i] = s;
+            pc = p->start + i;
+            switch (pc->opcode)
+            {
+                case Jmp:
+                    stack[n++] = pc->x;
+                    stack[n++] = d;
+                    break;
+                case Split:
+                    stack[n++] = pc->y;
+                    stack[n++] = d;
+                    stack[n++] = pc->x;
+                    stack[n++] = d;
+                    break;
+                case Save:
+                    path[d] = pc->n;
+                    stack[n++] = i + 1;
+                    stack[n++] = d + 1;
+                    break;
+                case Match:
+                    row[0] = addaction(&arena, &action, &naction, &maxaction,
+                                       &slots, &nslots, &maxslots, -1, 0, path, d);
+                    matched = 1;
+                    break;
+                case Char:
+                case Rng:
+                case Any:
+                case Set:
+                    k = addaction(&arena, &action, &naction, &maxaction,
+                                  &slots, &nslots, &maxslots, state[i + 1],
+                                  !matched, path, d);
+                    for (c = 0; c < nclass; c++)
+                    {
+                        if (!accepts(p, pc, classrep[c]))
+                            continue;
+                        if (row[c + 1] != 0)
+                            goto out;
+                        row[c + 1] = k;
+                    }
+                    break;
+                default:
+                    goto out;
+            }
+        }
+    }
+
+    size = sizeof(OnePass) + (size_t)nstate*(nclass + 1)*sizeof(int) +
+           (size_t)naction*ACTIONWORDS*sizeof(int) + (size_t)nslots*sizeof(int);
+    if ((o = (OnePass *)ualloc(alloc, size)) == NULL)
+        goto out;
+    o->nstate = nstate;
+    o->nslot = nslot;
+    o->nclass = nclass;
+    memcpy(o->classof, classof, sizeof(classof));
+    o->trans = (int *)(o + 1);
+    o->action = o->trans + nstate*(nclass + 1);
+    o->slots = o->action + naction*ACTIONWORDS;
+    memcpy(o->trans, trans, (size_t)nstate*(nclass + 1)*sizeof(int));
+    memcpy(o->action, action, (size_t)naction*ACTIONWORDS*sizeof(int));
+    memcpy(o->slots, slots, (size_t)nslots*sizeof(int));
+
+out:
+    arenafree(&arena);
+    if (p != orig)
+        ufree(alloc, p);
+    return o;
+}
+
+/* Set the slots of action k to pos */
+static void
+apply(OnePass *o, int *cap, int k, int pos)
+{
+    const int *a = o->action + k*ACTIONWORDS;
+    const int *slot = o->slots + a[2];
+    int i;
+
+    for (i = 0; i < a[3]; i++)
+        cap[slot[i]] = pos;
+}
+
+/* Match s from its start. Returns 1 on match, with the first ncap
+ * groups in caps.
+ */
+int
+onepassexec(OnePass *o, const char *s, int *caps, int ncap, ureg_matcher m)
+{
+    int *cur, *best, *row;
+    int i, k, state, matched = 0;
+    const char *sp;
+
+    cur = (int *)matcherscratch(m, (2*(size_t)o->nslot + 1)*sizeof(int));
+    if (cur == NULL)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        return -1;
+    }
+    best = cur + o->nslot;
+    for (i = 0; i < o->nslot; i++)
+        cur[i] = -1;
+    for (sp = s, state = 0; ; sp++)
+    {
+        row = o->trans + state*(o->nclass + 1);
+        if (row[0] != 0)
+        {
+            memcpy(best, cur, (size_t)o->nslot*sizeof(int));
+            apply(o, best, row[0], (int)(sp - s));
+            matched = 1;
+        }
+        if (*sp == '\0' || (k = row[1 + o->classof[(unsigned char)*sp]]) == 0)
+            break;
+        /* A match found first wins over going on */
+        if (row[0] != 0 && !o->action[k*ACTIONWORDS + 1])
+            break;
+        apply(o, cur, k, (int)(sp - s));
+        state = o->action[k*ACTIONWORDS];
+    }
+    for (i = 0; matched && i < 2*ncap; i++)
+        caps[i] = i < o->nslot ? best[i] : -1;
+    return matched;
+}
+
+void
+onepassfree(OnePass *o, const ureg_allocator *alloc)
+{
+    ufree(alloc, o);
+}
@@ -0,0 +1,545 @@
+/* optimize.c - AST rewriting passes run between parse() and compile()
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * parse() builds the tree exactly as written; the passes below turn it
+ * into an equivalent one which compiles to fewer instructions (and thus
+ * fewer threads per input byte). Every pass can be disabled with its own
+ * UREG_NOOPT_* flag.
+ *
+ * Nodes may be shared by several parents (see simplify_repeat()), so a
+ * pass never modifies its input: nodes whose children change are copied.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+/* A pass rewrites every node after its operands: kids() lists the
+ * operands of a node, post() builds its new form from their rewritten
+ * versions. rewrite() walks the tree with an explicit stack, so deeply
+ * nested patterns do not exhaust the C stack.
+ */
+typedef struct Pass Pass;
+struct Pass
+{
+    int (*kids)(Arena *, Regexp *, Regexp ***, void **);
+    Regexp *(*post)(Arena *, Regexp *, Regexp **, int, void *);
+};
+
+typedef struct Frame Frame;
+struct Frame
+{
+    Regexp *r;
+    Regexp **kids;
+    int nkids;
+    int next;
+    void *aux;
+};
+
+static Regexp*
+rewrite(Arena *arena, Regexp *r, const Pass *pass)
+{
+    Frame fbuf[STACKINIT], *f = fbuf, *top;
+    Regexp *vbuf[STACKINIT], **val = vbuf;
+    int nf, maxf = STACKINIT, nv = 0, maxv = STACKINIT;
+
+    f[0].r = r;
+    f[0].next = 0;
+    f[0].nkids = pass->kids(arena, r, &f[0].kids, &f[0].aux);
+    nf = 1;
+    while (nf > 0)
+    {
+        top = &f[nf - 1];
+        if (top->next < top->nkids)
+        {
+            r = top->kids[top->next++];
+            STACKROOM(arena, f, nf, maxf, 1);
+            f[nf].r = r;
+            f[nf].next = 0;
+            f[nf].nkids = pass->kids(arena, r, &f[nf].kids, &f[nf].aux);
+            nf++;
+            continue;
+        }
+        nv -= top->nkids;
+        r = pass->post(arena, top->r, val + nv, top->nkids, top->aux);
+        nf--;
+        STACKROOM(arena, val, nv, maxv, 1);
+        val[nv++] = r;
+    }
+    return val[0];
+}
+
+/* r with new children, copied only if they changed */
+static Regexp*
+rebuild(Arena *arena, Regexp *r, Regexp *left, Regexp *right)
+{
+    Regexp *n;
+
+    if (left == r->left && right == r->right)
+        return r;
+    n = (Regexp *)arenaalloc(arena, sizeof(Regexp));
+    *n = *r;
+    n->left = left;
+    n->right = right;
+    return n;
+}
+
+/* The children of r, as operands of a pass */
+static int
+operands(Arena *arena, Regexp *r, Regexp ***kids, void **aux)
+{
+    Regexp **k;
+
+    *aux = NULL;
+    if (r == NULL)
+        return 0;
+    switch (r->type)
+    {
+        case Alt:
+        case Cat:
+            k = (Regexp **)arenaalloc(arena, 2*sizeof(Regexp *));
+            k[0] = r->left;
+            k[1] = r->right;
+            *kids = k;
+            return 2;
+        case Quest:
+        case Star:
+        case Plus:
+        case Paren:
+        case Count:
+            *kids = &r->left;
+            return 1;
+    }
+    return 0;
+}
+
+/* r with its children replaced by the rewritten operands v */
+static Regexp*
+children(Arena *arena, Regexp *r, Regexp **v, int n)
+{
+    if (n == 2)
+        return rebuild(arena, r, v[0], v[1]);
+    if (n == 1)
+        return rebuild(arena, r, v[0], NULL);
+    return r;
+}
+
+/* Concatenation and alternation lists.
+ *
+ * A list of op (Cat or Alt) nodes is a right-leaning chain: each node
+ * holds an operand on the left and the rest of the list on the right.
+ * flatten() puts every list in this form; when it is disabled the other
+ * passes still work, but only see the right spine of each tree.
+ */
+static int
+nops(int op, Regexp *r)
+{
+    int n;
+
+    for (n = 1; r != NULL && r->type == op; r = r->right)
+        n++;
+    return n;
+}
+
+static void
+listops(int op, Regexp *r, Regexp **v)
+{
+    for (; r != NULL && r->type == op; r = r->right)
+        *v++ = r->left;
+    *v = r;
+}
+
+static Regexp*
+mklist(Arena *arena, int op, Regexp **v, int n)
+{
+    Regexp *r;
+
+    r = v[--n];
+    while (n > 0)
+        r = reg(arena, op, v[--n], r);
+    return r;
+}
+
+/* Concatenation of two possibly empty expressions */
+static Regexp*
+cat(Arena *arena, Regexp *a, Regexp *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    return reg(arena, Cat, a, b);
+}
+
+/* Drop capturing groups */
+static Regexp*
+dropparen(Arena *arena, Regexp *r, Regexp **v, int n, void *aux)
+{
+    UNUSED_PARAMETER(aux);
+    r = children(arena, r, v, n);
+    /* The group contents were rewritten first, so are no group */
+    if (r != NULL && r->type == Paren)
+        return r->left;
+    return r;
+}
+
+static const Pass dropparenpass = { operands, dropparen };
+
+/* Flattened operands of a tree of op nodes (an empty alternative is a
+ * NULL operand)
+ */
+static int
+spine(Arena *arena, Regexp *r, Regexp ***kids, void **aux)
+{
+    Regexp *buf[STACKINIT], **s = buf, **k;
+    int op, n, ns, maxs = STACKINIT, maxk = STACKINIT;
+
+    if (r == NULL || (r->type != Cat && r->type != Alt))
+        return operands(arena, r, kids, aux);
+    *aux = NULL;
+    op = r->type;
+    k = (Regexp **)arenaalloc(arena, maxk*sizeof(Regexp *));
+    n = 0;
+    s[0] = r;
+    ns = 1;
+    while (ns > 0)
+    {
+        r = s[--ns];
+        if (r != NULL && r->type == op)
+        {
+            STACKROOM(arena, s, ns, maxs, 2);
+            s[ns++] = r->right;
+            s[ns++] = r->left;
+            continue;
+        }
+        STACKROOM(arena, k, n, maxk, 1);
+        k[n++] = r;
+    }
+    *kids = k;
+    return n;
+}
+
+/* Turn nested concatenations and alternations into lists */
+static Regexp*
+flatten(Arena *arena, Regexp *r, Regexp **v, int n, void *aux)
+{
+    UNUSED_PARAMETER(aux);
+    if (r != NULL && (r->type == Cat || r->type == Alt))
+        return mklist(arena, r->type, v, n);
+    return children(arena, r, v, n);
+}
+
+static const Pass flattenpass = { spine, flatten };
+
+/* Structural equality */
+static int
+equal(Arena *arena, Regexp *a, Regexp *b)
+{
+    Regexp *buf[STACKINIT], **s = buf;
+    int n = 0, max = STACKINIT;
+
+    for (;;)
+    {
+        if (a != b)
+        {
+            if (a == NULL || b == NULL || a->type != b->type || a->n != b->n)
+                return 0;
+            STACKROOM(arena, s, n, max, 4);
+            switch (a->type)
+            {
+                case Lit:
+                    if (a->ch != b->ch)
+                        return 0;
+                    break;
+                case Dot:
+                    break;
+                case Range:
+                    if (a->lo != b->lo || a->hi != b->hi)
+                        return 0;
+                    break;
+                case Class:
+                    if (memcmp(a->bits, b->bits, CLASSBYTES) != 0)
+                        return 0;
+                    break;
+                case Str:
+                    if (memcmp(a->str, b->str, a->n) != 0)
+                        return 0;
+                    break;
+                case Count:
+                    if (a->lo != b->lo || a->hi != b->hi)
+                        return 0;
+                    /* Fall through */
+                case Quest:
+                case Star:
+                case Plus:
+                case Paren:
+                    s[n++] = a->left;
+                    s[n++] = b->left;
+                    break;
+                case Alt:
+                case Cat:
+                    s[n++] = a->right;
+                    s[n++] = b->right;
+                    s[n++] = a->left;
+                    s[n++] = b->left;
+                    break;
+                default:
+                    return 0;
+            }
+        }
+        if (n == 0)
+            return 1;
+        b = s[--n];
+        a = s[--n];
+    }
+}
+
+/* First operand of a concatenation and what follows it */
+static Regexp*
+head(Regexp *r)
+{
+    return (r != NULL && r->type == Cat) ? r->left : r;
+}
+
+static Regexp*
+tail(Regexp *r)
+{
+    return (r != NULL && r->type == Cat) ? r->right : NULL;
+}
+
+/* Factor common prefixes out of consecutive alternatives:
+ * abc|abd|x -> ab(?:c|d)|x
+ *
+ * The alternatives sharing a prefix are factored in turn, so the lists
+ * of their tails are the operands of an alternation.
+ */
+typedef struct Prefixes Prefixes;
+struct Prefixes
+{
+    /* Alternatives left, or shared prefixes where shared[i] is set */
+    Regexp **v;
+    char *shared;
+    int n;
+    int m;
+};
+
+static int
+prefixes(Arena *arena, Regexp *r, Regexp ***kids, void **aux)
+{
+    Prefixes *x;
+    Regexp **v, **t;
+    int n, m, i, j, k, nk;
+
+    if (r == NULL || r->type != Alt)
+    {
+        *aux = NULL;
+        return 0;
+    }
+    n = nops(Alt, r);
+    v = (Regexp **)arenaalloc(arena, n*sizeof(Regexp *));
+    listops(Alt, r, v);
+    x = (Prefixes *)arenaalloc(arena, sizeof(Prefixes));
+    x->shared = (char *)arenaalloc(arena, n);
+    *kids = (Regexp **)arenaalloc(arena, n*sizeof(Regexp *));
+    for (i = 0, m = 0, nk = 0; i < n; i = j)
+    {
+        for (j = i + 1; j < n && equal(arena, head(v[i]), head(v[j])); j++)
+            ;
+        if (j - i == 1 || head(v[i]) == NULL)
+        {
+            /* Nothing to share (duplicate empty branches just go away) */
+            v[m++] = v[i];
+            continue;
+        }
+        t = (Regexp **)arenaalloc(arena, (j - i)*sizeof(Regexp *));
+        for (k = i; k < j; k++)
+            t[k - i] = tail(v[k]);
+        (*kids)[nk++] = mklist(arena, Alt, t, j - i);
+        x->shared[m] = 1;
+        v[m++] = head(v[i]);
+    }
+    x->v = v;
+    x->n = n;
+    x->m = m;
+    *aux = x;
+    return nk;
+}
+
+static Regexp*
+factoralt(Arena *arena, Regexp *r, Regexp **tails, int nk, void *aux)
+{
+    Prefixes *x = (Prefixes *)aux;
+    int i;
+
+    UNUSED_PARAMETER(nk);
+    if (x == NULL || x->m == x->n)
+        return r;
+    for (i = 0; i < x->m; i++)
+        if (x->shared[i])
+            x->v[i] = cat(arena, x->v[i], *tails++);
+    return mklist(arena, Alt, x->v, x->m);
+}
+
+static const Pass prefixpass = { prefixes, factoralt };
+
+static Regexp*
+factor(Arena *arena, Regexp *r, Regexp **v, int n, void *aux)
+{
+    UNUSED_PARAMETER(aux);
+    r = children(arena, r, v, n);
+    if (r == NULL || r->type != Alt)
+        return r;
+    return rewrite(arena, r, &prefixpass);
+}
+
+static const Pass factorpass = { operands, factor };
+
+/* Single character matchers */
+static int
+single(Regexp *r)
+{
+    return r != NULL && (r->type == Lit || r->type == Dot ||
+                         r->type == Range || r->type == Class);
+}
+
+/* Merge consecutive single character alternatives: a|[b-d]|e -> [a-e] */
+static Regexp*
+mergeclass(Arena *arena, Regexp *r, Regexp **v, int n, void *aux)
+{
+    unsigned char *bits;
+    int m, i, j, k;
+
+    UNUSED_PARAMETER(aux);
+    r = children(arena, r, v, n);
+    if (r == NULL || r->type != Alt)
+        return r;
+    n = nops(Alt, r);
+    v = (Regexp **)arenaalloc(arena, n*sizeof(Regexp *));
+    listops(Alt, r, v);
+    for (i = 0, m = 0; i < n; i = j)
+    {
+        j = i + 1;
+        if (single(v[i]))
+            while (j < n && single(v[j]))
+                j++;
+        if (j - i == 1)
+        {
+            v[m++] = v[i];
+            continue;
+        }
+        bits = (unsigned char *)arenaalloc(arena, CLASSBYTES);
+        for (k = i; k < j; k++)
+            classadd(bits, v[k]);
+        v[m++] = classnode(arena, bits);
+    }
+    if (m == n)
+        return r;
+    return mklist(arena, Alt, v, m);
+}
+
+static const Pass mergeclasspass = { operands, mergeclass };
+
+/* Merge consecutive literals: abc -> "abc" */
+static Regexp*
+mergestr(Arena *arena, Regexp *r, Regexp **v, int n, void *aux)
+{
+    Regexp *s;
+    int m, i, j, k, len;
+
+    UNUSED_PARAMETER(aux);
+    r = children(arena, r, v, n);
+    if (r == NULL || r->type != Cat)
+        return r;
+    n = nops(Cat, r);
+    v = (Regexp **)arenaalloc(arena, n*sizeof(Regexp *));
+    listops(Cat, r, v);
+    for (i = 0, m = 0; i < n; i = j)
+    {
+        len = 0;
+        for (j = i; j < n && v[j] != NULL && (v[j]->type == Lit || v[j]->type == Str); j++)
+            len += v[j]->type == Lit ? 1 : v[j]->n;
+        if (j - i < 2)
+        {
+            if (j == i)
+                j++;
+            v[m++] = v[i];
+            continue;
+        }
+        s = reg(arena, Str, NULL, NULL);
+        s->str = (char *)arenaalloc(arena, len + 1);
+        for (k = i; k < j; k++)
+        {
+            if (v[k]->type == Lit)
+                s->str[s->n++] = (char)v[k]->ch;
+            else
+            {
+                memcpy(s->str + s->n, v[k]->str, v[k]->n);
+                s->n += v[k]->n;
+            }
+        }
+        v[m++] = s;
+    }
+    if (m == n)
+        return r;
+    return mklist(arena, Cat, v, m);
+}
+
+static const Pass mergestrpass = { operands, mergestr };
+
+/* Mirror image of a tree: matches the reverse of the strings r does */
+static Regexp*
+mirror(Arena *arena, Regexp *r, Regexp **v, int n, void *aux)
+{
+    Regexp *s;
+    int i;
+
+    UNUSED_PARAMETER(aux);
+    if (r == NULL)
+        return r;
+    if (r->type == Cat)
+        return rebuild(arena, r, v[1], v[0]);
+    if (r->type != Str)
+        return children(arena, r, v, n);
+    s = reg(arena, Str, NULL, NULL);
+    s->n = r->n;
+    s->str = (char *)arenaalloc(arena, r->n + 1);
+    for (i = 0; i < r->n; i++)
+        s->str[i] = r->str[r->n - 1 - i];
+    return s;
+}
+
+static const Pass mirrorpass = { operands, mirror };
+
+/* Reverse the strings matched by r, for automata run backwards */
+Regexp*
+reversed(Arena *arena, Regexp *r)
+{
+    return rewrite(arena, r, &mirrorpass);
+}
+
+/* Run the optimization passes not disabled by flags */
+Regexp*
+optimize(Arena *arena, Regexp *r, unsigned int flags)
+{
+    if (!(flags & (UREG_NOOPT_PAREN | UREG_CAPTURE)))
+        r = rewrite(arena, r, &dropparenpass);
+    if (!(flags & UREG_NOOPT_FLATTEN))
+        r = rewrite(arena, r, &flattenpass);
+    /* Before strings and classes, which hide single characters */
+    if (!(flags & UREG_NOOPT_PREFIX))
+    {
+        r = rewrite(arena, r, &factorpass);
+        /* Factored prefixes are concatenations within concatenations */
+        if (!(flags & UREG_NOOPT_FLATTEN))
+            r = rewrite(arena, r, &flattenpass);
+    }
+    if (!(flags & UREG_NOOPT_CLASS))
+        r = rewrite(arena, r, &mergeclasspass);
+    if (!(flags & UREG_NOOPT_STRING))
+        r = rewrite(arena, r, &mergestrpass);
+    return r;
+}
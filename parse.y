@@ -9,7 +9,9 @@
 
 /* Data type attached to terminals */
 %token_type {int}
-/* Data type attached to non-terminals */
+/* Data type attached to non-terminals. Nodes live in pParse->arena, so
+ * there is no need for destructors when the parser discards them.
+ */
 %default_type {Regexp*}
 
 /* Parser state */
@@ -32,6 +34,7 @@
 /* Code included near the beginning of the generated parser */
 %include {
 #include "stdinc.h"
+#include "ureg.h"
 #define UREG_INTERNAL
 #include "ureg-internal.h"
 
@@ -44,45 +47,65 @@ struct CountedRepVal {
     int high;
 };
 
-#ifndef NDEBUG
-#define trace_reg_destroy(a)                                                \
-    do {                                                                    \
-        if (yyTraceFILE)                                                    \
-            fprintf(yyTraceFILE, "%sdestroying %p\n", yyTracePrompt, a);    \
-        reg_destroy(a);                                                     \
-    } while (0)
-#else
-#define trace_reg_destroy(a)    reg_destroy(a)
-#endif /* !defined(NDEBUG) */
+}
+
+/* Code appended to the generated parser */
+%code {
+#if YYSTACKDEPTH<=0
+#error "uregParserInit() needs a fixed size parser stack"
+#endif
+
+/* Size of the parser state, see uregParserInit() */
+size_t
+uregParserSize(void)
+{
+    return sizeof(yyParser);
+}
+
+/* Same as uregParserAlloc(), with memory provided by the caller. The
+ * parser must not be passed to uregParserFree(): since AST nodes need no
+ * destructors, releasing the memory is enough.
+ */
+void *
+uregParserInit(void *p)
+{
+    yyParser *pParser = (yyParser *)p;
 
+    pParser->yyidx = -1;
+#ifdef YYTRACKMAXSTACKDEPTH
+    pParser->yyidxMax = 0;
+#endif
+    return pParser;
+}
 }
 
 /* Here comes the grammar */
 input ::= regexp(A).                { pParse->ast_root = A; }
-%destructor regexp { trace_reg_destroy($$); }
 regexp(A) ::= alt(B).               { A = B; }
 regexp(A) ::= STAR(B) alt(C).   {
-    Regexp *r1 = reg(Lit, NULL, NULL);
+    Regexp *r1 = reg(pParse->arena, Lit, NULL, NULL);
     r1->ch = B;
-    A = reg(Cat, r1, C);
+    A = reg(pParse->arena, Cat, r1, C);
 }
 
-/* Alternation */
-%destructor alt { trace_reg_destroy($$); }
+/* Alternation (an empty alternative, e.g. a{0}, still matches) */
 alt(A) ::= alt(B) ALT concat(C). {
     if (B == NULL && C == NULL)
         A = NULL;
     else if (B == NULL)
-        A = C;
+    {
+        /* Empty first: non-greedy */
+        A = reg(pParse->arena, Quest, C, NULL);
+        A->n = 1;
+    }
     else if (C == NULL)
-        A = B;
+        A = reg(pParse->arena, Quest, B, NULL);
     else
-        A = reg(Alt, B, C);
+        A = reg(pParse->arena, Alt, B, C);
 }
 alt(A) ::= concat(B).               { A = B; }
 
 /* Concatenation */
-%destructor concat { trace_reg_destroy($$); }
 concat(A) ::= concat(B) repeat(C). {
     if (B == NULL && C == NULL)
         A = NULL;
@@ -91,41 +114,40 @@ concat(A) ::= concat(B) repeat(C). {
     else if (C == NULL)
         A = B;
     else
-        A = reg(Cat, B, C);
+        A = reg(pParse->arena, Cat, B, C);
 }
 concat(A) ::= repeat(B).            { A = B; }
 
 /* Repetition */
-%destructor repeat { trace_reg_destroy($$); }
 repeat(A) ::= single(B).            { A = B; }
 /* Zero or more */
-repeat(A) ::= single(B) STAR.       { A = reg(Star, B, NULL); }
+repeat(A) ::= single(B) STAR.       { A = reg(pParse->arena, Star, B, NULL); }
 /* Zero or more (non-greedy) */
 repeat(A) ::= single(B) STAR QUES. {
-    A = reg(Star, B, NULL);
+    A = reg(pParse->arena, Star, B, NULL);
     A->n = 1;
 }
 /* One or more */
-repeat(A) ::= single(B) PLUS.       { A = reg(Plus, B, NULL); }
+repeat(A) ::= single(B) PLUS.       { A = reg(pParse->arena, Plus, B, NULL); }
 /* One or more (non-greedy) */
 repeat(A) ::= single(B) PLUS QUES. {
-    A = reg(Plus, B, NULL);
+    A = reg(pParse->arena, Plus, B, NULL);
     A->n = 1;
 }
 /* At most one */
-repeat(A) ::= single(B) QUES.       { A = reg(Quest, B, NULL); }
+repeat(A) ::= single(B) QUES.       { A = reg(pParse->arena, Quest, B, NULL); }
 /* At most one (non-greedy - yes, there is a ?? operator...) */
 repeat(A) ::= single(B) QUES QUES. {
-    A = reg(Quest, B, NULL);
+    A = reg(pParse->arena, Quest, B, NULL);
     A->n = 1;
 }
 /* Counted repetition */
 repeat(A) ::= single(B) LBRACE count(C) RBRACE. {
-    A = simplify_repeat(B, C.low, C.high, 0);
+    A = simplify_repeat(pParse->arena, B, C.low, C.high, 0, (pParse->flags & UREG_CAPTURE) != 0);
 }
 /* Counted repetition (non-greedy) */
 repeat(A) ::= single(B) LBRACE count(C) RBRACE QUES. {
-    A = simplify_repeat(B, C.low, C.high, 1);
+    A = simplify_repeat(pParse->arena, B, C.low, C.high, 1, (pParse->flags & UREG_CAPTURE) != 0);
 }
 
 /* Counted repetition statement */
@@ -144,22 +166,21 @@ count(A) ::= INTEGER(B) COMMA INTEGER(C). {
 }
 
 /* Single character match */
-%destructor single { trace_reg_destroy($$); }
 single(A) ::= COLON|LITERAL(B). {
-    A = reg(Lit, NULL, NULL);
+    A = reg(pParse->arena, Lit, NULL, NULL);
     A->ch = B;
 }
 single(A) ::= DOT. {
-    A = reg(Dot, NULL, NULL);
+    A = reg(pParse->arena, Dot, NULL, NULL);
 }
-single(A) ::= LBRACKET bracketexp(B) RBRACKET.  { A = B; }
-/* Capturing group */
-single(A) ::= LPAREN alt(B) RPAREN. {
-    if (B != NULL)
+single(A) ::= LBRACKET bracketexp(B) RBRACKET.  { A = bracket(pParse->arena, B, 0); }
+single(A) ::= NLBRACKET bracketexp(B) RBRACKET. { A = bracket(pParse->arena, B, 1); }
+/* Capturing group (empty ones only matter for captures) */
+single(A) ::= LPAREN(N) alt(B) RPAREN. {
+    if (B != NULL || (pParse->flags & UREG_CAPTURE))
     {
-        pParse->nparen++;
-        A = reg(Paren, B, NULL);
-        A->n = pParse->nparen;
+        A = reg(pParse->arena, Paren, B, NULL);
+        A->n = N;
     }
     else
         A = NULL;
@@ -168,30 +189,27 @@ single(A) ::= LPAREN alt(B) RPAREN. {
 single(A) ::= LPAREN QUES COLON alt(B) RPAREN.  { A = B; }
 
 /* Oversimplified bracket expression grammar */
-%destructor bracketexp { trace_reg_destroy($$); }
 bracketexp(A) ::= class(B).         { A = B; }
 
 /* Character class */
-%destructor class { trace_reg_destroy($$); }
-class(A) ::= class(B) range(C).     { A = reg(Alt, B, C); }
+class(A) ::= class(B) range(C).     { A = reg(pParse->arena, Alt, B, C); }
 class(A) ::= range(B).              { A = B; }
 
 /* Range expression */
-%destructor range { trace_reg_destroy($$); }
 range(A) ::= COLON|LITERAL(B). {
-    A = reg(Lit, NULL, NULL);
+    A = reg(pParse->arena, Lit, NULL, NULL);
     A->ch = B;
 }
 range(A) ::= COLON|LITERAL(B) RSEP LITERAL(C). {
     /* Both ends of range expression are equal, transform them into a literal */
     if (B == C)
     {
-        A = reg(Lit, NULL, NULL);
+        A = reg(pParse->arena, Lit, NULL, NULL);
         A->ch = B;
     }
     else
     {
-        A = reg(Range, NULL, NULL);
+        A = reg(pParse->arena, Range, NULL, NULL);
         if (B < C)
         {
             A->lo = B;
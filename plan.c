@@ -0,0 +1,136 @@
+/* plan.c - choice of matching engines
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * Which engine runs a program fastest depends on the pattern and on the
+ * length of the input. plan() looks at a handle once, when it is made,
+ * and records its choices in the handle's strategy; every match only
+ * compares the input length against shortmax. Current rules:
+ *
+ * - literal patterns, and two strings with a gap of any bytes in
+ *   between, are searched for as strings (see literal.c), for matches
+ *   and captures alike;
+ * - native code, when there is some, matches inputs of any length;
+ * - otherwise inputs short enough for the backtracker's bitmap (see
+ *   bitstate.c) are backtracked over; longer ones are simulated, unless
+ *   every match needs a string the automata can be run around (see
+ *   reverse.c);
+ * - UREG_NOOPT_STRING, which keeps strings out of the AST, also keeps
+ *   them from being searched for: no literal or reverse engine;
+ * - captures of one-pass anchored patterns use the one-pass table,
+ *   other ones the backtracker or the Pike VM in the same way.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+/* Automata to run around a string every match of re needs, built from
+ * r or, if NULL, from the pattern parsed again. Running out of memory
+ * only leaves them out.
+ */
+static Reverse*
+reverseplan(struct ureg_regexp_t *re, Regexp *r)
+{
+    Arena arena;
+    jmp_buf oom;
+    Reverse *rv = NULL;
+
+    arenainit(&arena, &re->alloc, &oom);
+    if (setjmp(oom) == 0)
+    {
+        if (r == NULL && (r = parse(re->txt, &arena, re->flags)) != NULL)
+            r = optimize(&arena, r, re->flags);
+        rv = reversebuild(r, re->flags, &arena, &re->alloc);
+    }
+    arenafree(&arena);
+    return rv;
+}
+
+/* Fill in the strategy of re, building the tables it needs. r is the
+ * optimized AST of the pattern, NULL to parse it again if needed. Native
+ * code is made from native (NULL if not wanted) when it is of any use.
+ */
+void
+plan(struct ureg_regexp_t *re, Regexp *r, Prog *native)
+{
+    ureg_strategy *s = &re->strategy;
+    Prog *p = re->p;
+    ureg_engine_t shortengine;
+
+    memset(s, '\0', sizeof(*s));
+    s->size = (size_t)p->len;
+    if (re->flags & UREG_ANCHORED)
+        s->props |= UREG_PROP_ANCHORED;
+    if (re->flags & UREG_CAPTURE)
+        s->props |= UREG_PROP_CAPTURE;
+    /* Searching for strings is the string pass taken further */
+    if (!(re->flags & UREG_NOOPT_STRING) &&
+        (re->literal = literalbuild(re->txt, re->flags, &re->alloc)) != NULL)
+    {
+        s->props |= literalgap(re->literal) ? UREG_PROP_GAP : UREG_PROP_LITERAL;
+        s->match = s->shortmatch = UREG_ENGINE_LITERAL;
+        if (re->flags & UREG_CAPTURE)
+            s->capture = s->shortcapture = UREG_ENGINE_LITERAL;
+        return;
+    }
+    if (native != NULL)
+        re->jit = jitcompile(native, re->txt, re->flags & UREG_JIT_PERFMAP, &re->alloc);
+    if (p->nrepeat > 0)
+        s->props |= UREG_PROP_COUNTERS;
+
+    /* A bit per instruction and position, the end of the string
+     * included; counters have no place in the bitmap
+     */
+    shortengine = UREG_ENGINE_BACKTRACK;
+    if (p->nrepeat > 0 || UREG_BITSTATE_MAX / p->len < 2)
+        shortengine = UREG_ENGINE_NONE;
+
+    s->match = re->jit != NULL ? UREG_ENGINE_JIT : UREG_ENGINE_NFA;
+    if (re->jit == NULL && !(re->flags & UREG_NOOPT_STRING) &&
+        (re->reverse = reverseplan(re, r)) != NULL)
+    {
+        s->props |= reversesuffix(re->reverse) ? UREG_PROP_SUFFIX : UREG_PROP_INNER;
+        s->match = UREG_ENGINE_REVERSE;
+    }
+    s->shortmatch = s->match;
+    if (re->jit == NULL && shortengine != UREG_ENGINE_NONE)
+        s->shortmatch = shortengine;
+
+    if (re->flags & UREG_CAPTURE)
+    {
+        if (re->flags & UREG_ANCHORED)
+            re->onepass = onepassbuild(p, &re->alloc);
+        if (re->onepass != NULL)
+        {
+            s->props |= UREG_PROP_ONEPASS;
+            s->capture = s->shortcapture = UREG_ENGINE_ONEPASS;
+        }
+        else
+        {
+            s->capture = s->shortcapture = UREG_ENGINE_PIKEVM;
+            if (shortengine != UREG_ENGINE_NONE)
+                s->shortcapture = shortengine;
+        }
+    }
+
+    if (s->shortmatch != s->match || s->shortcapture != s->capture)
+        s->shortmax = UREG_BITSTATE_MAX / p->len - 1;
+}
+
+/* Length of s if it is at most max bytes long, -1 otherwise. Only looks
+ * at the first max + 1 bytes.
+ */
+int
+shortlen(const char *s, size_t max)
+{
+    size_t n;
+
+    for (n = 0; s[n] != '\0'; n++)
+        if (n >= max)
+            return -1;
+    return (int)n;
+}
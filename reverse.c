@@ -0,0 +1,182 @@
+/* reverse.c - matching around a literal the pattern requires
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * When every match of a pattern ends with a string ("[0-9]+ms") or
+ * goes through one ("[a-z]+@example\.[a-z]+"), that string is looked
+ * for first, with the substring searcher of literal.c, and the automata
+ * only run around its occurrences: a DFA of what comes before the
+ * string, compiled from the mirror image of that part of the AST, runs
+ * backwards from the occurrence; a DFA of what comes after, if anything,
+ * runs forwards from its end. Text without the string is never run
+ * through an automaton at all.
+ *
+ * Occurrences close together could have the automata go over the same
+ * bytes again and again, so they get a budget proportional to the
+ * input: past it, reverseexec() gives up and the caller simulates the
+ * whole program instead, which keeps matching linear.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+/* Bigger automata are left to the simulation */
+#define REVERSE_MAXSTATE    512
+
+/* Shortest strings worth looking for, at the end of the pattern and
+ * anywhere else
+ */
+#define REVERSE_MINSUFFIX   2
+#define REVERSE_MININNER    3
+
+struct Reverse
+{
+    Literal *lit;
+    long len;
+    /* Mirror image of what comes before the string */
+    Dfa *pre;
+    /* What comes after it, NULL if nothing does */
+    Dfa *post;
+};
+
+/* Program for the concatenation of the n expressions in v, mirrored
+ * first if rev is set
+ */
+static Prog*
+partprog(Arena *arena, Regexp **v, int n, int rev, unsigned int flags)
+{
+    Regexp *r;
+
+    r = v[--n];
+    while (n > 0)
+        r = reg(arena, Cat, v[--n], r);
+    if (rev)
+        r = reversed(arena, r);
+    /* As for native code, counters are expanded; groups do not matter */
+    expand_counts(arena, r);
+    return compile(r, arena, flags & ~UREG_CAPTURE);
+}
+
+/* Build the automata for r, the optimized AST of a pattern. Returns
+ * NULL if the pattern needs no string worth looking for, or if the
+ * automata would be too big.
+ */
+Reverse*
+reversebuild(Regexp *r, unsigned int flags, Arena *arena, const ureg_allocator *alloc)
+{
+    Reverse *rv;
+    Regexp *t, **v;
+    Prog *pre, *post;
+    int n, i, k;
+
+    /* parse() puts unanchored patterns after a non-greedy Star(Dot) */
+    if (r == NULL || (flags & UREG_ANCHORED) || r->type != Cat ||
+        r->left == NULL || r->left->type != Star || r->left->left->type != Dot)
+        return NULL;
+    r = r->right;
+    if (r != NULL && r->type == Paren)
+        r = r->left;
+
+    /* The concatenated parts of the pattern */
+    for (n = 1, t = r; t != NULL && t->type == Cat; t = t->right)
+        n++;
+    if (r == NULL || n < 2)
+        return NULL;
+    v = (Regexp **)arenaalloc(arena, n*sizeof(Regexp *));
+    for (n = 0, t = r; t->type == Cat; t = t->right)
+        v[n++] = t->left;
+    v[n++] = t;
+
+    /* A string at the end, or the longest one past the first part */
+    k = -1;
+    if (v[n - 1]->type == Str && v[n - 1]->n >= REVERSE_MINSUFFIX)
+        k = n - 1;
+    else
+    {
+        for (i = 1; i < n - 1; i++)
+            if (v[i]->type == Str && v[i]->n >= REVERSE_MININNER &&
+                (k < 0 || v[i]->n > v[k]->n))
+                k = i;
+    }
+    if (k < 0)
+        return NULL;
+
+    /* Everything from the arena first: running out of it must not leave
+     * anything else allocated
+     */
+    pre = partprog(arena, v, k, 1, flags);
+    post = k < n - 1 ? partprog(arena, v + k + 1, n - k - 1, 0, flags) : NULL;
+    if (pre == NULL || (k < n - 1 && post == NULL))
+        return NULL;
+
+    if ((rv = (Reverse *)ucalloc(alloc, sizeof(Reverse))) == NULL)
+        return NULL;
+    rv->len = v[k]->n;
+    rv->lit = literalstring(v[k]->str, v[k]->n, alloc);
+    rv->pre = dfabuild(pre, REVERSE_MAXSTATE, alloc);
+    if (post != NULL)
+        rv->post = dfabuild(post, REVERSE_MAXSTATE, alloc);
+    if (rv->lit == NULL || rv->pre == NULL || (post != NULL && rv->post == NULL))
+    {
+        reversefree(rv, alloc);
+        return NULL;
+    }
+    return rv;
+}
+
+/* Does s match? Returns 1 or 0, -1 if the automata ran out of budget
+ * (the answer is then up to the caller).
+ */
+int
+reverseexec(Reverse *rv, const char *s)
+{
+    const unsigned char *y = (const unsigned char *)s;
+    long n, pos, q, from = 0, work = 0, budget;
+    int state;
+
+    n = (long)strlen(s);
+    budget = 2*n + 256;
+    while ((pos = literalfind(rv->lit, s + from, n - from)) >= 0)
+    {
+        pos += from;
+        /* Backwards from the string, stopping at Match or at a dead end */
+        for (state = rv->pre->start, q = pos; state >= 0 && q > 0; )
+            state = rv->pre->trans[state*256 + y[--q]];
+        work += pos - q;
+        if (state == DfaMatch && rv->post != NULL)
+        {
+            /* NUL leads nowhere, so this stops at the end */
+            for (state = rv->post->start, q = pos + rv->len; state >= 0; )
+                state = rv->post->trans[state*256 + y[q++]];
+            work += q - pos - rv->len;
+        }
+        if (state == DfaMatch)
+            return 1;
+        if (work > budget)
+            return -1;
+        from = pos + 1;
+    }
+    return 0;
+}
+
+/* Does the string end every match? */
+int
+reversesuffix(const Reverse *rv)
+{
+    return rv->post == NULL;
+}
+
+void
+reversefree(Reverse *rv, const ureg_allocator *alloc)
+{
+    if (rv == NULL)
+        return;
+    literalfree(rv->lit, alloc);
+    ufree(alloc, rv->pre);
+    ufree(alloc, rv->post);
+    ufree(alloc, rv);
+}
@@ -0,0 +1,294 @@
+/* serialize.c - saving and loading compiled regexps
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * A serialized regexp is laid out as:
+ *
+ *      +----------------+  offset 0
+ *      | SerialHeader   |
+ *      +----------------+  SERIAL_PROGOFF
+ *      | Prog           |  hdr.progsize bytes, used in place
+ *      +----------------+  SERIAL_PROGOFF + hdr.progsize
+ *      | pattern text   |  hdr.txtsize bytes, NUL-terminated
+ *      +----------------+
+ *
+ * Programs are position-independent (instructions refer to each other by
+ * index), so a loaded regexp points straight into the blob and no fix-up
+ * is required: a blob mapped from disk is only paged in as it is used.
+ * The format is tied to the host byte order and structure layout, both of
+ * which are recorded in the header and checked on load.
+ */
+
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+#define SERIAL_MAGIC    "uREG"
+#define SERIAL_VERSION  7
+#define SERIAL_BOM      0x01020304U
+
+typedef struct SerialHeader SerialHeader;
+struct SerialHeader
+{
+    char magic[4];
+    unsigned int version;
+    /* Byte order and layout of the host which wrote the blob */
+    unsigned int bom;
+    unsigned int instsize;
+    /* Flags given to ureg_compile() */
+    unsigned int flags;
+    unsigned int progsize;
+    unsigned int txtsize;
+    /* Adler-32 of everything past the header */
+    unsigned int checksum;
+};
+
+/* Programs are placed on an 8 byte boundary */
+#define SERIAL_ALIGN    8
+#define SERIAL_PROGOFF  ((sizeof(SerialHeader) + SERIAL_ALIGN - 1) & ~(size_t)(SERIAL_ALIGN - 1))
+
+static unsigned int
+adler32(const unsigned char *buf, size_t len)
+{
+    unsigned long a = 1, b = 0;
+    size_t n;
+
+    while (len > 0)
+    {
+        /* Largest block which cannot overflow 32 bit accumulators */
+        n = len < 5552 ? len : 5552;
+        len -= n;
+        while (n--)
+        {
+            a += *buf++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (unsigned int)((b << 16) | a);
+}
+
+/* Largest counter accepted in a loaded Repeat instruction */
+#define SERIAL_MAXREPEAT    (1 << 24)
+
+/* Check the body and counters of a Repeat instruction. Parameters are
+ * not shared, so that counters are not either.
+ */
+static int
+repeatvalid(const Prog *p, int i, int *nrepeat, long *ncount)
+{
+    const Inst *pc = p->start + i, *b;
+    const RepeatArgs *a;
+    int k, pos = 0;
+
+    if (pc->y < *nrepeat || pc->y >= p->nrepeat)
+        return 0;
+    *nrepeat = pc->y + 1;
+    a = PROGREPEAT(p, pc->y);
+    if (a->lo < 0 || a->lo >= SERIAL_MAXREPEAT || a->hi >= SERIAL_MAXREPEAT ||
+        (a->hi >= 0 && (a->hi < 1 || a->hi < a->lo)) || a->hi < -1 ||
+        pc->n < 1 || pc->x - i - 1 < pc->n || pc->x >= p->len ||
+        a->cnt != *ncount)
+        return 0;
+    /* Single character matchers, by nondecreasing position */
+    for (k = 1; i + k < pc->x; k++)
+    {
+        b = pc + k;
+        if (b->opcode != Char && b->opcode != Any && b->opcode != Rng &&
+            b->opcode != Set)
+            return 0;
+        if (b->n != pos && (k == 1 || b->n != pos + 1))
+            return 0;
+        pos = b->n;
+    }
+    if (pos != pc->n - 1)
+        return 0;
+    *ncount += REPEATWORDS(pc, a);
+    return 1;
+}
+
+/* Check the epsilon closure tables */
+static int
+closurevalid(const Prog *p)
+{
+    const int *t = PROGCLOSURE(p);
+    int i, k;
+
+    if (p->nclosure == 0)
+        return 1;
+    if (p->nclosure <= p->len)
+        return 0;
+    for (i = 0; i < p->len; i++)
+    {
+        if (t[i] == -1)
+            continue;
+        if (t[i] < p->len || t[i] >= p->nclosure - 1 ||
+            t[t[i]] < 0 || t[t[i]] > p->nclosure - t[i] - 2 ||
+            t[t[i] + 1] < -1 || t[t[i] + 1] >= p->nclass)
+            return 0;
+        for (k = 2; k < 2 + t[t[i]]; k++)
+            if (t[t[i] + k] < 0 || t[t[i] + k] >= p->len)
+                return 0;
+    }
+    return 1;
+}
+
+/* Make sure a loaded program cannot send the VM outside of it. Save
+ * slots are bounded by the groups a pattern of txtsize bytes can have.
+ */
+static int
+progvalid(const Prog *p, size_t txtsize)
+{
+    const Inst *pc;
+    long ncount = 0;
+    int i, nrepeat = 0;
+
+    for (i = 0; i < p->len; i++)
+    {
+        pc = p->start + i;
+        switch (pc->opcode)
+        {
+            default:
+                return 0;
+            case Split:
+                if (pc->y < 0 || pc->y >= p->len)
+                    return 0;
+                /* Fall through */
+            case Jmp:
+                if (pc->x < 0 || pc->x >= p->len)
+                    return 0;
+                break;
+            case Set:
+                if (pc->y < 0 || pc->y >= p->nclass)
+                    return 0;
+                if (i + 1 >= p->len)
+                    return 0;
+                break;
+            case Save:
+                if (pc->n < 0 || (size_t)pc->n >= 2*txtsize)
+                    return 0;
+                if (i + 1 >= p->len)
+                    return 0;
+                break;
+            case String:
+                /* The VM relies on literals holding no NUL */
+                if (pc->n < 1 || pc->y < 0 || pc->y > p->nstr - pc->n ||
+                    memchr(PROGSTR(p) + pc->y, '\0', pc->n) != NULL)
+                    return 0;
+                /* Fall through */
+            case Char:
+            case Any:
+            case Rng:
+                /* Execution continues with the next instruction */
+                if (i + 1 >= p->len)
+                    return 0;
+                break;
+            case Match:
+                break;
+            case Repeat:
+                if (!repeatvalid(p, i, &nrepeat, &ncount) || ncount > p->ncount)
+                    return 0;
+                break;
+        }
+    }
+    if (ncount != p->ncount || !closurevalid(p))
+        return 0;
+    /* The VM relies on NUL never being in a set */
+    for (i = 0; i < p->nclass; i++)
+        if (PROGCLASS(p, i)[0] & 1)
+            return 0;
+    return 1;
+}
+
+/* Serialize a compiled regexp */
+size_t
+ureg_serialize(ureg_regexp handle, void *buf, size_t len)
+{
+    SerialHeader hdr;
+    unsigned char *out = (unsigned char *)buf;
+    size_t need;
+
+    if(handle == NULL || handle->p == NULL || handle->txt == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return 0;
+    }
+    memset(&hdr, '\0', sizeof(hdr));
+    memcpy(hdr.magic, SERIAL_MAGIC, sizeof(hdr.magic));
+    hdr.version = SERIAL_VERSION;
+    hdr.bom = SERIAL_BOM;
+    hdr.instsize = sizeof(Inst);
+    hdr.flags = handle->flags;
+    hdr.progsize = progsize(handle->p);
+    hdr.txtsize = strlen(handle->txt) + 1;
+    need = SERIAL_PROGOFF + hdr.progsize + hdr.txtsize;
+    ureg_errno = UREG_NOERROR;
+    /* Just report the size if there is not enough room */
+    if(out == NULL || len < need)
+        return need;
+
+    memset(out, '\0', SERIAL_PROGOFF);
+    memcpy(out + SERIAL_PROGOFF, handle->p, hdr.progsize);
+    memcpy(out + SERIAL_PROGOFF + hdr.progsize, handle->txt, hdr.txtsize);
+    hdr.checksum = adler32(out + sizeof(hdr), need - sizeof(hdr));
+    memcpy(out, &hdr, sizeof(hdr));
+    return need;
+}
+
+/* Load a regexp from a serialized blob, without copying it */
+ureg_regexp
+ureg_load(const void *buf, size_t len)
+{
+    const unsigned char *in = (const unsigned char *)buf;
+    const SerialHeader *hdr = (const SerialHeader *)buf;
+    const Prog *p;
+    struct ureg_regexp_t *res;
+
+    if(buf == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return NULL;
+    }
+    ureg_errno = UREG_ERR_FORMAT;
+    if(((size_t)in % SERIAL_ALIGN) != 0 || len < SERIAL_PROGOFF)
+        return NULL;
+    if(memcmp(hdr->magic, SERIAL_MAGIC, sizeof(hdr->magic)) != 0 ||
+       hdr->version != SERIAL_VERSION || hdr->bom != SERIAL_BOM ||
+       hdr->instsize != sizeof(Inst))
+        return NULL;
+    if(hdr->progsize < sizeof(Prog) || hdr->txtsize < 1 ||
+       len - SERIAL_PROGOFF < hdr->progsize ||
+       len - SERIAL_PROGOFF - hdr->progsize < hdr->txtsize)
+        return NULL;
+    if(adler32(in + sizeof(*hdr), SERIAL_PROGOFF + hdr->progsize + hdr->txtsize - sizeof(*hdr)) != hdr->checksum)
+        return NULL;
+    p = (const Prog *)(in + SERIAL_PROGOFF);
+    if(p->len < 1 || p->nrepeat < 0 || p->nclosure < 0 || p->nstr < 0 || p->nclass < 0 || progsize((Prog *)p) != hdr->progsize ||
+       !progvalid(p, hdr->txtsize) ||
+       in[SERIAL_PROGOFF + hdr->progsize + hdr->txtsize - 1] != '\0')
+        return NULL;
+
+    res = (struct ureg_regexp_t *)ualloc(curalloc(), sizeof(struct ureg_regexp_t));
+    if(res == NULL)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        return NULL;
+    }
+    res->p = (Prog *)p;
+    res->txt = (const char *)(in + SERIAL_PROGOFF + hdr->progsize);
+    res->flags = hdr->flags;
+    res->refc = 1;
+    res->alloc = *curalloc();
+    res->mem = res;
+    res->jit = NULL;
+    res->onepass = NULL;
+    res->literal = NULL;
+    res->reverse = NULL;
+    plan(res, NULL, res->flags & UREG_JIT ? res->p : NULL);
+    ureg_errno = UREG_NOERROR;
+    return res;
+}
@@ -11,5 +11,21 @@
 #cmakedefine HAVE_STDLIB_H 1
 #cmakedefine HAVE_STRING_H 1
 #cmakedefine HAVE_STRINGS_H 1
+#cmakedefine HAVE_SYS_MMAN_H 1
+#cmakedefine HAVE_UNISTD_H 1
+
+/* Functions */
+#cmakedefine HAVE_POSIX_MEMALIGN 1
+#cmakedefine HAVE_MEMFD_CREATE 1
+
+/* Threads and atomics */
+#cmakedefine HAVE_PTHREAD 1
+#cmakedefine HAVE_SYNC_BUILTINS 1
+
+/* VM dispatch */
+#cmakedefine UREG_COMPUTED_GOTO 1
+
+/* Native code generation */
+#cmakedefine UREG_JIT_X86_64 1
 
 #endif /* INCLUDED_setup_h */
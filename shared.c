@@ -0,0 +1,377 @@
+/* shared.c - regexp sets in shared memory
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * A set is a read-only memory region holding a header, a table of
+ * offsets and the serialized form (see serialize.c) of every regexp:
+ *
+ *      +----------------+  offset 0
+ *      | SetHeader      |
+ *      +----------------+
+ *      | offsets[count] |  region offset of every blob
+ *      +----------------+
+ *      | blob 0         |  8 byte aligned
+ *      | ...            |
+ *      +----------------+  SetHeader.size
+ *
+ * The region is backed by an anonymous file (memfd or unlinked POSIX
+ * shared memory object), so it is shared both with children forked after
+ * ureg_set_compile() and with any process the descriptor is passed to.
+ * Since programs are never written to while matching, the pages stay
+ * shared for the whole lifetime of the processes; each process only owns
+ * the small handles pointing into the region.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1   /* memfd_create() */
+#endif
+#include "stdinc.h"
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define SET_MAGIC       "uSET"
+#define SET_VERSION     1
+#define SET_ALIGN       8
+#define SET_ROUND(x)    (((x) + SET_ALIGN - 1) & ~(size_t)(SET_ALIGN - 1))
+
+typedef struct SetHeader SetHeader;
+struct SetHeader
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int count;
+    unsigned int size;
+    unsigned int offsets[1];
+};
+
+#define SET_HDRSIZE(n)  SET_ROUND(sizeof(SetHeader) + ((n) - 1)*sizeof(unsigned int))
+
+struct ureg_set_t
+{
+    /* Read-only mapping of the region */
+    void *base;
+    size_t size;
+    /* Backing descriptor, -1 if none */
+    int fd;
+    /* Non-zero if fd has been created by us */
+    int ownfd;
+    size_t count;
+    ureg_regexp *handles;
+    /* Allocator owning this struct, handles[] and the fallback region */
+    ureg_allocator alloc;
+};
+
+/* Create an anonymous shared memory file of the given size */
+static int
+shmfile(size_t size)
+{
+#ifdef HAVE_SYS_MMAN_H
+    int fd;
+# ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create("ureg-set", MFD_CLOEXEC);
+# else
+    static unsigned int seq = 0;
+    char name[64];
+
+    sprintf(name, "/ureg-%ld-%u", (long)getpid(), seq++);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        shm_unlink(name);
+# endif /* HAVE_MEMFD_CREATE */
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    UNUSED_PARAMETER(size);
+    return -1;
+#endif /* HAVE_SYS_MMAN_H */
+}
+
+static void
+unmap(struct ureg_set_t *set)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (set->fd >= 0)
+    {
+        munmap(set->base, set->size);
+        if (set->ownfd)
+            close(set->fd);
+        return;
+    }
+#endif
+    ufree(&set->alloc, set->base);
+}
+
+/* Check the region and create a handle for every regexp in it */
+static int
+attach(struct ureg_set_t *set)
+{
+    const SetHeader *hdr = (const SetHeader *)set->base;
+    const unsigned char *base = (const unsigned char *)set->base;
+    size_t i, end;
+
+    ureg_errno = UREG_ERR_FORMAT;
+    if (set->size < sizeof(SetHeader) ||
+        memcmp(hdr->magic, SET_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != SET_VERSION || hdr->size != set->size ||
+        hdr->count == 0 || SET_HDRSIZE(hdr->count) > set->size)
+        return 0;
+    set->count = hdr->count;
+    set->handles = (ureg_regexp *)ucalloc(&set->alloc, set->count*sizeof(ureg_regexp));
+    if (set->handles == NULL)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        return 0;
+    }
+    for (i = 0; i < set->count; i++)
+    {
+        end = (i + 1 < set->count) ? hdr->offsets[i + 1] : set->size;
+        if (hdr->offsets[i] < SET_HDRSIZE(hdr->count) || end > set->size ||
+            hdr->offsets[i] > end)
+            return 0;
+        set->handles[i] = ureg_load(base + hdr->offsets[i], end - hdr->offsets[i]);
+        if (set->handles[i] == NULL)
+            return 0;
+    }
+    ureg_errno = UREG_NOERROR;
+    return 1;
+}
+
+/* Compile a list of patterns into a new shared region */
+ureg_set
+ureg_set_compile(const char *const *patterns, size_t n, unsigned int flags)
+{
+    struct ureg_set_t *set;
+    ureg_regexp *tmp;
+    unsigned char *buf;
+    SetHeader *hdr;
+    size_t i, off, size;
+    int ok = 0;
+
+    if (patterns == NULL || n == 0)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return NULL;
+    }
+    if ((set = (struct ureg_set_t *)ucalloc(curalloc(), sizeof(*set))) == NULL)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        return NULL;
+    }
+    set->alloc = *curalloc();
+    if ((tmp = (ureg_regexp *)ucalloc(&set->alloc, n*sizeof(ureg_regexp))) == NULL)
+    {
+        ufree(&set->alloc, set);
+        ureg_errno = UREG_ERR_NOMEM;
+        return NULL;
+    }
+    set->fd = -1;
+
+    /* Compile everything first to size the region */
+    size = SET_HDRSIZE(n);
+    for (i = 0; i < n; i++)
+    {
+        if ((tmp[i] = ureg_compile_with(patterns[i], flags, &set->alloc)) == NULL)
+            goto out;
+        size += SET_ROUND(ureg_serialize(tmp[i], NULL, 0));
+    }
+
+    set->size = size;
+    set->fd = shmfile(size);
+#ifdef HAVE_SYS_MMAN_H
+    if (set->fd >= 0)
+    {
+        buf = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, set->fd, 0);
+        if (buf == (unsigned char *)MAP_FAILED)
+        {
+            close(set->fd);
+            set->fd = -1;
+            ureg_errno = UREG_ERR_NOMEM;
+            goto out;
+        }
+        set->ownfd = 1;
+    }
+    else
+#endif
+    /* No shared memory: still usable by children forked after this */
+    if ((buf = (unsigned char *)ualloc(&set->alloc, size)) == NULL)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        goto out;
+    }
+
+    memset(buf, '\0', SET_HDRSIZE(n));
+    hdr = (SetHeader *)buf;
+    memcpy(hdr->magic, SET_MAGIC, sizeof(hdr->magic));
+    hdr->version = SET_VERSION;
+    hdr->count = n;
+    hdr->size = size;
+    off = SET_HDRSIZE(n);
+    for (i = 0; i < n; i++)
+    {
+        hdr->offsets[i] = off;
+        off += SET_ROUND(ureg_serialize(tmp[i], buf + off, size - off));
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    /* Replace the writable mapping with a read-only one */
+    if (set->fd >= 0)
+    {
+        munmap(buf, size);
+        buf = (unsigned char *)mmap(NULL, size, PROT_READ, MAP_SHARED, set->fd, 0);
+        if (buf == (unsigned char *)MAP_FAILED)
+        {
+            close(set->fd);
+            set->fd = -1;
+            ureg_errno = UREG_ERR_NOMEM;
+            goto out;
+        }
+    }
+#endif
+    set->base = buf;
+    ok = attach(set);
+
+out:
+    for (i = 0; i < n; i++)
+        if (tmp[i])
+            ureg_free(tmp[i]);
+    ufree(&set->alloc, tmp);
+    if (!ok)
+    {
+        i = ureg_errno;
+        ureg_set_free(set);
+        ureg_errno = (ureg_error_t)i;
+        return NULL;
+    }
+    ureg_errno = UREG_NOERROR;
+    return set;
+}
+
+/* Map a region created by another process */
+ureg_set
+ureg_set_open(int fd)
+{
+#ifdef HAVE_SYS_MMAN_H
+    struct ureg_set_t *set;
+    struct stat st;
+    void *base;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return NULL;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        return NULL;
+    }
+    if ((set = (struct ureg_set_t *)ucalloc(curalloc(), sizeof(*set))) == NULL)
+    {
+        munmap(base, (size_t)st.st_size);
+        ureg_errno = UREG_ERR_NOMEM;
+        return NULL;
+    }
+    set->alloc = *curalloc();
+    set->base = base;
+    set->size = (size_t)st.st_size;
+    set->fd = fd;
+    set->ownfd = 0;
+    if (!attach(set))
+    {
+        int e = ureg_errno;
+        ureg_set_free(set);
+        ureg_errno = (ureg_error_t)e;
+        return NULL;
+    }
+    return set;
+#else
+    UNUSED_PARAMETER(fd);
+    ureg_errno = UREG_ERR_NULL;
+    return NULL;
+#endif /* HAVE_SYS_MMAN_H */
+}
+
+/* Descriptor backing a set */
+int
+ureg_set_fd(ureg_set set)
+{
+    if (set == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return -1;
+    }
+    ureg_errno = UREG_NOERROR;
+    return set->fd;
+}
+
+/* Number of regexps in a set */
+size_t
+ureg_set_count(ureg_set set)
+{
+    if (set == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return 0;
+    }
+    ureg_errno = UREG_NOERROR;
+    return set->count;
+}
+
+/* Get the i-th regexp of a set */
+ureg_regexp
+ureg_set_get(ureg_set set, size_t i)
+{
+    if (set == NULL || i >= set->count)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return NULL;
+    }
+    ureg_errno = UREG_NOERROR;
+    return set->handles[i];
+}
+
+/* Release a set */
+void
+ureg_set_free(ureg_set set)
+{
+    ureg_allocator alloc;
+    size_t i;
+
+    if (set == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return;
+    }
+    if (set->handles)
+    {
+        for (i = 0; i < set->count; i++)
+            if (set->handles[i])
+                ureg_free(set->handles[i]);
+        ufree(&set->alloc, set->handles);
+    }
+    if (set->base)
+        unmap(set);
+    else if (set->ownfd)
+        close(set->fd);
+    alloc = set->alloc;
+    ufree(&alloc, set);
+    ureg_errno = UREG_NOERROR;
+}
@@ -25,5 +25,6 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <setjmp.h>
 
 #endif /* INCLUDED_stdinc_h */
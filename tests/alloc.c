@@ -0,0 +1,118 @@
+/* Test runner for allocator hooks */
+#include <stdio.h>
+#include <stdlib.h>
+#include "ureg.h"
+
+/* Per-tenant accounting, failing past limit calls unless it is -1 */
+typedef struct
+{
+    long gcalls, calls;
+    long live;
+    long limit;
+} Tenant;
+
+static void *countalloc(void *ctx, size_t size)
+{
+    Tenant *t = (Tenant *)ctx;
+
+    if (t->limit >= 0 && t->calls >= t->limit)
+        return NULL;
+    t->calls++;
+    t->live++;
+    return malloc(size);
+}
+
+static void countfree(void *ctx, void *p)
+{
+    ((Tenant *)ctx)->live--;
+    free(p);
+}
+
+int main(int argc, char **argv)
+{
+    Tenant global = {0, 0, 0, -1}, a = {0, 0, 0, -1}, b = {0, 0, 0, -1}, f = {0, 0, 0, -1};
+    ureg_allocator ga = { countalloc, countfree, NULL };
+    ureg_allocator aa = { countalloc, countfree, NULL };
+    ureg_allocator ba = { countalloc, countfree, NULL };
+    ureg_allocator fa = { countalloc, countfree, NULL };
+    ureg_matcher m;
+    ureg_regexp r;
+    unsigned long ev, flags = 0;
+    char *err = NULL;
+    long gcalls, calls, n;
+    int res = 0;
+
+    if (argc < 4)
+        exit(1);
+    ev = strtoul(argv[3], &err, 10);
+    if (err == NULL || err == argv[3] || *err != '\0' || ev > 1)
+        exit(1);
+    if (argc > 4)
+    {
+        flags = strtoul(argv[4], &err, 0);
+        if (err == argv[4] || *err != '\0')
+            exit(1);
+    }
+    ga.ctx = &global;
+    aa.ctx = &a;
+    ba.ctx = &b;
+    fa.ctx = &f;
+
+    /* Global allocator */
+    ureg_set_allocator(&ga);
+    if ((r = ureg_compile(argv[1], (unsigned int)flags)) == NULL)
+        exit(1);
+    res |= ureg_match(r, argv[2]) != (int)ev;
+    ureg_free(r);
+    res |= global.calls == 0 || global.live != 0;
+
+    /* Per-handle allocator: nothing goes through the global one */
+    gcalls = global.calls;
+    if ((r = ureg_compile_with(argv[1], (unsigned int)flags, &aa)) == NULL)
+        exit(1);
+    res |= ureg_match(r, argv[2]) != (int)ev;
+    res |= a.calls == 0;
+
+    /* Per-matcher allocator: scratch memory is reused across matches */
+    if ((m = ureg_matcher_new(&ba)) == NULL)
+        exit(1);
+    res |= ureg_matcher_match(m, r, argv[2]) != (int)ev;
+    calls = a.calls + b.calls;
+    res |= ureg_matcher_match(m, r, argv[2]) != (int)ev;
+    res |= a.calls + b.calls != calls;
+    ureg_matcher_free(m);
+    ureg_free(r);
+    res |= a.live != 0 || b.live != 0 || global.calls != gcalls;
+
+    /* Failing after n calls, for every n until none fails: compiling
+     * gives up with nothing left allocated, or does without some engine
+     */
+    for (n = 0; !res; n++)
+    {
+        f.calls = 0;
+        f.limit = n;
+        r = ureg_compile_with(argv[1], (unsigned int)flags, &fa);
+        f.limit = -1;
+        calls = f.calls;
+        if (r == NULL)
+        {
+            res |= ureg_errno != UREG_ERR_NOMEM || f.live != 0;
+            continue;
+        }
+        res |= ureg_match(r, argv[2]) != (int)ev;
+        ureg_free(r);
+        res |= f.live != 0;
+        if (calls < n)
+            break;
+    }
+
+    /* Restore malloc() */
+    ureg_set_allocator(NULL);
+    if ((r = ureg_compile(argv[1], (unsigned int)flags)) == NULL)
+        exit(1);
+    res |= ureg_match(r, argv[2]) != (int)ev;
+    ureg_free(r);
+    res |= global.live != 0;
+
+    exit(res);
+}
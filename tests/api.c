@@ -1,13 +1,20 @@
 /* Test runner for public API tests */
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include "setup.h"
 #include "ureg.h"
 
+/* Platforms jit.c generates code for */
+#if defined(UREG_JIT_X86_64) && (defined(__x86_64__) || defined(__amd64__))
+#define NATIVE  1
+#endif
+
 int main(int argc, char **argv)
 {
     ureg_regexp r;
-    unsigned long ev;
-    char *err = NULL;
+    unsigned long ev, flags = 0;
+    char *err = NULL, path[64];
     int res;
 
     if (argc < 4)
@@ -15,12 +22,32 @@ int main(int argc, char **argv)
     ev = strtoul(argv[3], &err, 10);
     if (err == NULL || err == argv[3] || *err != '\0' || ev > 1)
         exit(1);
-    r = ureg_compile(argv[1], 0);
+    /* Optional compilation flags */
+    if (argc > 4)
+    {
+        flags = strtoul(argv[4], &err, 0);
+        if (err == argv[4] || *err != '\0')
+            exit(1);
+    }
+    r = ureg_compile(argv[1], (unsigned int)flags);
     if (r == NULL)
         exit(1);
 
-    res = ureg_match(r, argv[2]) != ev;
+    res = ureg_match(r, argv[2]) != (int)ev;
+    /* Matching must not leave state behind in the handle */
+    res |= ureg_match(r, argv[2]) != (int)ev;
 
     ureg_free(r);
+
+    /* Native code registered for perf(1) must not outlive the test */
+    if (flags & UREG_JIT_PERFMAP)
+    {
+        sprintf(path, "/tmp/perf-%ld.map", (long)getpid());
+#ifdef NATIVE
+        res |= remove(path) != 0;
+#else
+        remove(path);
+#endif
+    }
     exit(res);
 }
@@ -0,0 +1,66 @@
+/* Test runner for the backtracker: short inputs are backtracked over,
+ * long ones are left to the VMs, results must be the same
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ureg.h"
+
+/* Longer than any bitmap the backtracker accepts */
+#define PAD     (1 << 20)
+
+static const struct
+{
+    const char *re;
+    const char *str;
+} cases[] = {
+    { "(?:hello|goodbye) world", "say goodbye world" },
+    { "(?:hello|goodbye) world", "say goodbye, world" },
+    { "a(b*)(c|bc)", "xabbbcd" },
+    { "a((?:b|c)+?)(c*)d", "abcbccd" },
+    { "x(?:ab|a)*(b?)y", "xaabaaby" },
+    { "x(a|ab)(c|bcd)(d*)", "xabcd" },
+    { "q(a*)*b", "qaaaaac" },
+    { "k[0-9]+(ms|s)", "took k125ms" },
+    { "z(y)?(y)?(y)?", "zyy" }
+};
+#define NCASES  (sizeof(cases)/sizeof(cases[0]))
+
+int main(void)
+{
+    int scaps[8], lcaps[8], i, k, rs, rl, res = 0;
+    ureg_regexp r, c;
+    char *pad;
+    size_t n;
+
+    if ((pad = malloc(PAD + 64)) == NULL)
+        exit(1);
+    memset(pad, '-', PAD);
+    for (i = 0; i < (int)NCASES; i++)
+    {
+        n = strlen(cases[i].str);
+        strcpy(pad + PAD, cases[i].str);
+        r = ureg_compile(cases[i].re, 0);
+        c = ureg_compile(cases[i].re, UREG_CAPTURE);
+        if (r == NULL || c == NULL)
+            exit(1);
+        rs = ureg_match(r, cases[i].str);
+        rl = ureg_match(r, pad);
+        res |= rs < 0 || rs != rl;
+        res |= ureg_match(c, cases[i].str) != rs || ureg_match(c, pad) != rs;
+        rs = ureg_match_captures(c, cases[i].str, scaps, 4);
+        rl = ureg_match_captures(c, pad, lcaps, 4);
+        res |= rs != rl;
+        for (k = 0; rs == 1 && k < 8; k++)
+            res |= scaps[k] != (lcaps[k] < 0 ? -1 : lcaps[k] - PAD);
+        if (res)
+        {
+            fprintf(stderr, "/%s/ on \"%s\" (%lu bytes)\n", cases[i].re, cases[i].str, (unsigned long)n);
+            break;
+        }
+        ureg_free(r);
+        ureg_free(c);
+    }
+    free(pad);
+    exit(res);
+}
@@ -0,0 +1,98 @@
+/* Test runner for the regexp cache */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ureg.h"
+
+#define NTHREADS    8
+#define NLOOPS      2000
+
+static const struct
+{
+    const char *pattern;
+    const char *str;
+    int ev;
+} cases[] = {
+    { "he.+o", "hello world", 1 },
+    { "g.*bye", "hello there!", 0 },
+    { "(?:hello|goodbye) world", "hello world", 1 },
+    { "a{7}b", "ab", 0 },
+    { "a{5,}b", "aaaaaaab", 1 },
+    { "(antani ?){5}", "antani antani antani antani antani", 1 },
+    { "F{4}U{8,}", "FFFFUUUUUUUUUUUUUUUUU", 1 },
+    { "F{4}U{8,}", "FFFUUUUUUUU", 0 }
+};
+#define NCASES  (sizeof(cases)/sizeof(cases[0]))
+
+static ureg_cache cache;
+
+static void *worker(void *arg)
+{
+    size_t i, k;
+    ureg_regexp r;
+    long failed = 0;
+
+    for (i = 0; i < NLOOPS; i++)
+    {
+        k = (i + (size_t)arg) % NCASES;
+        if ((r = ureg_cache_compile(cache, cases[k].pattern, 0)) == NULL)
+            return (void *)1;
+        failed |= ureg_match(r, cases[k].str) != cases[k].ev;
+        ureg_free(r);
+    }
+    return (void *)failed;
+}
+
+int main(void)
+{
+    ureg_cache_stats st;
+    ureg_regexp r1, r2, r3;
+    pthread_t th[NTHREADS];
+    char pattern[32];
+    void *ret;
+    int i, res = 0;
+
+    /* Same key, same handle; different flags, different handle */
+    if ((cache = ureg_cache_new(16)) == NULL)
+        exit(1);
+    r1 = ureg_cache_compile(cache, "x+y", 0);
+    r2 = ureg_cache_compile(cache, "x+y", 0);
+    r3 = ureg_cache_compile(cache, "x+y", UREG_JIT);
+    if (r1 == NULL || r1 != r2 || r3 == NULL || r3 == r1)
+        exit(1);
+    ureg_cache_getstats(cache, &st);
+    res |= st.hits != 1 || st.misses != 2 || st.entries != 2;
+    ureg_free(r2);
+    ureg_free(r3);
+
+    /* Filling the cache evicts entries, handles outlive their eviction */
+    for (i = 0; i < 200; i++)
+    {
+        sprintf(pattern, "p%dq", i);
+        ureg_free(ureg_cache_compile(cache, pattern, 0));
+    }
+    ureg_cache_getstats(cache, &st);
+    res |= st.entries > 16 || st.evictions < 184;
+    res |= ureg_match(r1, "xxxy") != 1;
+    ureg_free(r1);
+    ureg_cache_free(cache);
+
+    /* Concurrent lookups */
+    if ((cache = ureg_cache_new(64)) == NULL)
+        exit(1);
+    for (i = 0; i < NTHREADS; i++)
+        if (pthread_create(&th[i], NULL, worker, (void *)(size_t)i) != 0)
+            exit(1);
+    for (i = 0; i < NTHREADS; i++)
+    {
+        pthread_join(th[i], &ret);
+        res |= ret != NULL;
+    }
+    ureg_cache_getstats(cache, &st);
+    res |= st.hits + st.misses != NTHREADS*NLOOPS;
+    res |= st.entries != NCASES - 1 || st.evictions != 0;
+    ureg_cache_free(cache);
+
+    exit(res);
+}
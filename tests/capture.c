@@ -0,0 +1,91 @@
+/* Test runner for submatch extraction */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ureg.h"
+
+#define MAXCAP  10
+
+/* Parse "s,e s,e ..." into caps, "-" for no match. Returns the number
+ * of groups, -1 for no match, -2 on error.
+ */
+static int parsecaps(const char *spec, int *caps)
+{
+    char *err;
+    int n = 0;
+
+    if (strcmp(spec, "-") == 0)
+        return -1;
+    while (*spec != '\0' && n < MAXCAP)
+    {
+        caps[2*n] = (int)strtol(spec, &err, 10);
+        if (err == spec || *err != ',')
+            return -2;
+        spec = err + 1;
+        caps[2*n + 1] = (int)strtol(spec, &err, 10);
+        if (err == spec || (*err != ' ' && *err != '\0'))
+            return -2;
+        spec = *err == ' ' ? err + 1 : err;
+        n++;
+    }
+    return *spec == '\0' ? n : -2;
+}
+
+/* n expected groups, no match if n < 0 */
+static int check(int res, const int *caps, const int *ecaps, int n)
+{
+    int i;
+
+    if (res != (n >= 0))
+        return 1;
+    for (i = 0; i < 2*n; i++)
+        if (caps[i] != ecaps[i])
+            return 1;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int caps[2*MAXCAP + 2], ecaps[2*MAXCAP];
+    ureg_regexp r;
+    ureg_matcher m;
+    unsigned long flags = 0;
+    char *err = NULL;
+    int n, k, res = 0;
+
+    if (argc < 4)
+        exit(1);
+    if ((n = parsecaps(argv[3], ecaps)) == -2)
+        exit(1);
+    /* Optional compilation flags, besides UREG_CAPTURE */
+    if (argc > 4)
+    {
+        flags = strtoul(argv[4], &err, 0);
+        if (err == argv[4] || *err != '\0')
+            exit(1);
+    }
+    r = ureg_compile(argv[1], (unsigned int)flags | UREG_CAPTURE);
+    if (r == NULL)
+        exit(1);
+
+    /* Groups past the expected ones are reported unset */
+    k = n < 0 ? 0 : n;
+    caps[2*k] = caps[2*k + 1] = 0;
+    res |= check(ureg_match_captures(r, argv[2], caps, k + 1), caps, ecaps, n);
+    res |= n >= 0 && (caps[2*k] != -1 || caps[2*k + 1] != -1);
+    res |= ureg_match(r, argv[2]) != (n >= 0);
+    if ((m = ureg_matcher_new(NULL)) == NULL)
+        exit(1);
+    res |= check(ureg_matcher_captures(m, r, argv[2], caps, k), caps, ecaps, n);
+    res |= check(ureg_matcher_captures(m, r, argv[2], caps, k), caps, ecaps, n);
+    ureg_matcher_free(m);
+    ureg_free(r);
+
+    /* Only regexps compiled for captures report them */
+    r = ureg_compile(argv[1], (unsigned int)flags);
+    if (r == NULL)
+        exit(1);
+    res |= ureg_match_captures(r, argv[2], caps, k) != -1 || ureg_errno != UREG_ERR_CAPTURE;
+    ureg_free(r);
+    exit(res);
+}
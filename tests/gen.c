@@ -0,0 +1,35 @@
+/* Test runner for ureg-gen generated matchers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "patterns.h"
+
+static const struct
+{
+    const char *name;
+    int (*fn)(const char *);
+} matchers[] = {
+    { "hello", hello },
+    { "goodbye", goodbye },
+    { "greeting", greeting },
+    { "antani", antani },
+    { "ffffuuuu", ffffuuuu },
+    { "digits", digits }
+};
+
+int main(int argc, char **argv)
+{
+    unsigned long ev;
+    char *err = NULL;
+    size_t i;
+
+    if (argc < 4)
+        exit(1);
+    ev = strtoul(argv[3], &err, 10);
+    if (err == NULL || err == argv[3] || *err != '\0' || ev > 1)
+        exit(1);
+    for (i = 0; i < sizeof(matchers)/sizeof(matchers[0]); i++)
+        if (strcmp(matchers[i].name, argv[1]) == 0)
+            exit(matchers[i].fn(argv[2]) != (int)ev);
+    exit(1);
+}
@@ -0,0 +1,99 @@
+/* Test runner for the literal searcher: literal patterns must give the
+ * same results as the same patterns in a group, which go through the
+ * automata
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ureg.h"
+
+static const char *patterns[] = {
+    "a", "ab", "aab", "abab", "aaaa", "abaabaab", "bba", "ba|ab",
+    "ab|aba|b", "aaab|aab|ab", "a:b|b\\|a", "abcabd", "babb|ba", "a\\.b",
+    "baababaaba", "bbabaa", "abbabbab|bbaab",
+    /* Gaps */
+    "ab.*ba", "a.+b", "ab.{2}ba", "b.{1,3}ab", "aa.{0,}b", "a.{2,}a",
+    "b.{0}a", "a\\..*b", "bab.{0,2}aab"
+};
+#define NPATTERNS   (sizeof(patterns)/sizeof(patterns[0]))
+
+static const unsigned int flags[] = {
+    0, UREG_ANCHORED, UREG_CAPTURE, UREG_CAPTURE | UREG_ANCHORED
+};
+#define NFLAGS      (sizeof(flags)/sizeof(flags[0]))
+
+/* Every string of up to 8 bytes over "ab", some longer ones, then a few
+ * others
+ */
+static const char *others[] = {
+    "a:b", "b|a", "xa.bx", "abcabcabdabd", "aaaaaaaaaaaaaaaaaaaab"
+};
+#define NOTHERS     (sizeof(others)/sizeof(others[0]))
+
+static int check(ureg_regexp lit, ureg_regexp ref, const char *s, int capture)
+{
+    int lcaps[4], rcaps[4], k, res;
+
+    if (ureg_match(lit, s) != ureg_match(ref, s))
+        return 1;
+    if (!capture)
+        return 0;
+    res = ureg_match_captures(lit, s, lcaps, 2);
+    if (res != ureg_match_captures(ref, s, rcaps, 2))
+        return 1;
+    for (k = 0; res == 1 && k < 4; k++)
+        if (lcaps[k] != rcaps[k])
+            return 1;
+    return 0;
+}
+
+int main(void)
+{
+    ureg_strategy st;
+    ureg_regexp lit, ref;
+    char grouped[64], s[32];
+    size_t i, j;
+    unsigned long seed = 1;
+    int len, bits, k, res = 0;
+
+    for (i = 0; i < NPATTERNS && !res; i++)
+    {
+        sprintf(grouped, "(?:%s)", patterns[i]);
+        for (j = 0; j < NFLAGS && !res; j++)
+        {
+            lit = ureg_compile(patterns[i], flags[j]);
+            ref = ureg_compile(grouped, flags[j]);
+            if (lit == NULL || ref == NULL)
+                exit(1);
+            ureg_getstrategy(lit, &st);
+            res |= st.match != UREG_ENGINE_LITERAL;
+            for (len = 0; len <= 8 && !res; len++)
+            {
+                for (bits = 0; bits < (1 << len) && !res; bits++)
+                {
+                    for (k = 0; k < len; k++)
+                        s[k] = (bits & (1 << k)) ? 'b' : 'a';
+                    s[len] = '\0';
+                    res |= check(lit, ref, s, (flags[j] & UREG_CAPTURE) != 0);
+                }
+            }
+            for (bits = 0; bits < 500 && !res; bits++)
+            {
+                for (k = 0; k < 30; k++)
+                {
+                    seed = seed*1103515245 + 12345;
+                    s[k] = (seed >> 16) & 1 ? 'b' : 'a';
+                }
+                s[30] = '\0';
+                res |= check(lit, ref, s, (flags[j] & UREG_CAPTURE) != 0);
+            }
+            for (k = 0; k < (int)NOTHERS && !res; k++)
+                res |= check(lit, ref, strcpy(s, others[k]), (flags[j] & UREG_CAPTURE) != 0);
+            if (res)
+                fprintf(stderr, "/%s/ flags %#x on \"%s\"\n", patterns[i], flags[j], s);
+            ureg_free(lit);
+            ureg_free(ref);
+        }
+    }
+    exit(res);
+}
@@ -0,0 +1,70 @@
+/* Test runner for AST optimization passes: every combination of passes
+ * must give the same results as no optimization at all
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "ureg.h"
+
+static const char *patterns[] = {
+    "a|b|c",
+    "[a-c]|d|[x-z]",
+    "abc|abd|abe|x",
+    "ab|a|abc",
+    "(?:hello|help|helm) world",
+    "(a|b)(c|d)e",
+    "((ab)c)(d(ef))",
+    "x(?:ab|ac|ad){20}y",
+    "(?:foo|foobar|fob)+z",
+    "a.c|a.d|[ab]",
+    "(a|a)(b|b|c)",
+    "q[a-z0-9]{16,}r",
+    "[^a-c]d|[^x]"
+};
+#define NPATTERNS   (sizeof(patterns)/sizeof(patterns[0]))
+
+static const char *strings[] = {
+    "", "a", "d", "zz", "abd", "abf", "x", "help world", "helm worl",
+    "hello world", "bde", "ace", "abcdef", "xadacabadabababacacacadadadacacacy",
+    "foobarfobfooz", "fobar", "axc", "a\nd", "ab", "q0123456789abcdefr",
+    "q0123456789abcder"
+};
+#define NSTRINGS    (sizeof(strings)/sizeof(strings[0]))
+
+static const unsigned int passes[] = {
+    UREG_NOOPT_PAREN, UREG_NOOPT_FLATTEN, UREG_NOOPT_PREFIX,
+    UREG_NOOPT_CLASS, UREG_NOOPT_STRING
+};
+#define NPASSES     (sizeof(passes)/sizeof(passes[0]))
+
+int main(void)
+{
+    ureg_regexp ref, r;
+    unsigned int flags;
+    size_t i, j, k;
+    int res = 0;
+
+    for (i = 0; i < NPATTERNS; i++)
+    {
+        if ((ref = ureg_compile(patterns[i], UREG_NOOPT)) == NULL)
+            exit(1);
+        for (k = 0; k < (1U << NPASSES); k++)
+        {
+            for (flags = 0, j = 0; j < NPASSES; j++)
+                if (k & (1U << j))
+                    flags |= passes[j];
+            if ((r = ureg_compile(patterns[i], flags)) == NULL)
+                exit(1);
+            for (j = 0; j < NSTRINGS; j++)
+            {
+                if (ureg_match(r, strings[j]) != ureg_match(ref, strings[j]))
+                {
+                    fprintf(stderr, "/%s/ (flags %#x) on \"%s\"\n", patterns[i], flags, strings[j]);
+                    res = 1;
+                }
+            }
+            ureg_free(r);
+        }
+        ureg_free(ref);
+    }
+    exit(res);
+}
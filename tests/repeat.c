@@ -0,0 +1,76 @@
+/* Test runner for counted repetitions */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ureg.h"
+
+static const struct
+{
+    const char *body;   /* text matched by one iteration */
+    const char *re;     /* pattern for one iteration */
+    int lo, hi;         /* hi == -1: no upper bound */
+} cases[] = {
+    { "a", "a", 100, 100 },
+    { "a", "a", 0, 63 },
+    { "a", "a", 64, 65 },
+    { "z", ".", 20, -1 },
+    { "b", "[a-c]", 127, 130 },
+    { "ab", "ab", 30, 40 },
+    { "1.", "[0-9].", 16, -1 },
+    { "abc", "a[bx]c", 0, 70 }
+};
+#define NCASES  (sizeof(cases)/sizeof(cases[0]))
+
+static int check(const char *pattern, unsigned int flags, const char *body, int k, int ev)
+{
+    static char str[4096];
+    ureg_regexp r;
+    int i, res;
+
+    strcpy(str, "x");
+    for (i = 0; i < k; i++)
+        strcat(str, body);
+    strcat(str, "y");
+    if ((r = ureg_compile(pattern, flags)) == NULL)
+        return 1;
+    res = ureg_match(r, str) != ev || ureg_match(r, str) != ev;
+    if (res)
+        fprintf(stderr, "/%s/ (flags %u) on %d iterations: expected %d\n", pattern, flags, k, ev);
+    ureg_free(r);
+    return res;
+}
+
+int main(void)
+{
+    char pattern[64];
+    ureg_regexp r1, r2;
+    size_t i;
+    int k, ev, res = 0;
+
+    for (i = 0; i < NCASES; i++)
+    {
+        if (cases[i].hi < 0)
+            sprintf(pattern, "x(?:%s){%d,}y", cases[i].re, cases[i].lo);
+        else
+            sprintf(pattern, "x(?:%s){%d,%d}y", cases[i].re, cases[i].lo, cases[i].hi);
+        for (k = 0; k < 140; k++)
+        {
+            ev = k >= cases[i].lo && (cases[i].hi < 0 || k <= cases[i].hi);
+            res |= check(pattern, 0, cases[i].body, k, ev);
+            res |= check(pattern, UREG_JIT, cases[i].body, k, ev);
+        }
+    }
+
+    /* Program size does not depend on the repetition count (the patterns
+     * have the same length, as the text is serialized too)
+     */
+    r1 = ureg_compile("xa{00020}y", 0);
+    r2 = ureg_compile("xa{99999}y", 0);
+    if (r1 == NULL || r2 == NULL)
+        exit(1);
+    res |= ureg_serialize(r1, NULL, 0) != ureg_serialize(r2, NULL, 0);
+    ureg_free(r1);
+    ureg_free(r2);
+
+    exit(res);
+}
@@ -0,0 +1,89 @@
+/* Test runner for matching around required strings: short inputs are
+ * backtracked over, the same inputs padded past the backtracker's reach
+ * are matched around the strings, results must be the same; long
+ * inputs must also match as without merged strings, which leaves them
+ * to the VM
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ureg.h"
+
+/* Longer than any bitmap the backtracker accepts */
+#define PAD     (1 << 16)
+
+static const struct
+{
+    const char *re;
+    const char *alphabet;
+    unsigned int prop;
+} cases[] = {
+    { "[0-9]+ms", "0ms", UREG_PROP_SUFFIX },
+    { "a[bc]*cab", "abc", UREG_PROP_SUFFIX },
+    { "(a|b)+bab", "abc", UREG_PROP_SUFFIX },
+    { "c*ab", "abc", UREG_PROP_SUFFIX },
+    { "(b|ca)a{2,3}b{0,2}aba", "abc", UREG_PROP_SUFFIX },
+    /* Long runs of the class before each string */
+    { "x[a-c]*cab", "abc", UREG_PROP_SUFFIX },
+    { "(?:ab|b)*bba(a|b)+c", "abc", UREG_PROP_INNER },
+    { "[a-c]+abc[a-c]*d", "abd", UREG_PROP_INNER },
+    { "b?cab(?:ba)*", "abc", UREG_PROP_INNER }
+};
+#define NCASES  (sizeof(cases)/sizeof(cases[0]))
+
+int main(void)
+{
+    ureg_strategy st;
+    ureg_regexp r, ref;
+    char s[7], *pad;
+    unsigned long seed = 1;
+    int i, k, len, code, n, m, res = 0;
+
+    if ((pad = malloc(PAD + 16)) == NULL)
+        exit(1);
+    for (i = 0; i < (int)NCASES && !res; i++)
+    {
+        r = ureg_compile(cases[i].re, 0);
+        ref = ureg_compile(cases[i].re, UREG_NOOPT_STRING);
+        if (r == NULL || ref == NULL)
+            exit(1);
+        ureg_getstrategy(r, &st);
+        res |= st.match != UREG_ENGINE_REVERSE || !(st.props & cases[i].prop);
+        ureg_getstrategy(ref, &st);
+        res |= st.match == UREG_ENGINE_REVERSE;
+
+        /* Every string of up to 6 bytes, after or before padding */
+        memset(pad, 'z', PAD);
+        for (len = 0, n = 1; len <= 6 && !res; len++, n *= 3)
+        {
+            for (code = 0; code < n && !res; code++)
+            {
+                for (k = 0, m = code; k < len; k++, m /= 3)
+                    s[k] = cases[i].alphabet[m % 3];
+                s[len] = '\0';
+                strcpy(pad + PAD, s);
+                res |= ureg_match(r, pad) != ureg_match(r, s);
+                memcpy(pad, s, len);
+                pad[PAD] = '\0';
+                res |= ureg_match(r, pad) != ureg_match(r, s);
+                memset(pad, 'z', len);
+            }
+        }
+        for (k = 0; k < 10 && !res; k++)
+        {
+            for (len = 0; len < PAD; len++)
+            {
+                seed = seed*1103515245 + 12345;
+                pad[len] = cases[i].alphabet[(seed >> 16) % 3];
+            }
+            pad[PAD] = '\0';
+            res |= ureg_match(r, pad) != ureg_match(ref, pad);
+        }
+        if (res)
+            fprintf(stderr, "/%s/\n", cases[i].re);
+        ureg_free(r);
+        ureg_free(ref);
+    }
+    free(pad);
+    exit(res);
+}
@@ -0,0 +1,60 @@
+/* Test runner for ureg_serialize()/ureg_load() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "ureg.h"
+
+int main(int argc, char **argv)
+{
+    ureg_regexp r, l;
+    unsigned long ev;
+    char *err = NULL;
+    unsigned char *buf;
+    void *map;
+    size_t len;
+    FILE *f;
+    int res;
+
+    if (argc < 4)
+        exit(1);
+    ev = strtoul(argv[3], &err, 10);
+    if (err == NULL || err == argv[3] || *err != '\0' || ev > 1)
+        exit(1);
+    r = ureg_compile(argv[1], 0);
+    if (r == NULL)
+        exit(1);
+
+    /* Size query, then the real thing */
+    len = ureg_serialize(r, NULL, 0);
+    if (len == 0 || (buf = (unsigned char *)malloc(len)) == NULL)
+        exit(1);
+    if (ureg_serialize(r, buf, len) != len)
+        exit(1);
+    ureg_free(r);
+
+    /* Load from a read-only file mapping */
+    if ((f = tmpfile()) == NULL || fwrite(buf, 1, len, f) != len || fflush(f) != 0)
+        exit(1);
+    map = mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(f), 0);
+    if (map == MAP_FAILED)
+        exit(1);
+    if ((l = ureg_load(map, len)) == NULL)
+        exit(1);
+    res = ureg_match(l, argv[2]) != (int)ev;
+    res |= strcmp(ureg_txt(l), argv[1]) != 0;
+    ureg_free(l);
+    munmap(map, len);
+    fclose(f);
+
+    /* Corrupted and truncated blobs must be rejected */
+    buf[len - 2] ^= 0x20;
+    if (ureg_load(buf, len) != NULL || ureg_errno != UREG_ERR_FORMAT)
+        res = 1;
+    buf[len - 2] ^= 0x20;
+    if (ureg_load(buf, len - 1) != NULL || ureg_errno != UREG_ERR_FORMAT)
+        res = 1;
+
+    free(buf);
+    exit(res);
+}
@@ -0,0 +1,55 @@
+/* Test runner for shared regexp sets */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "ureg.h"
+
+/* Match every regexp of the set, 0 if all results are as expected */
+static int check(ureg_set set, const char *str, const char *ev)
+{
+    size_t i;
+
+    if (ureg_set_count(set) != strlen(ev))
+        return 1;
+    for (i = 0; i < ureg_set_count(set); i++)
+        if (ureg_match(ureg_set_get(set, i), str) != ev[i] - '0')
+            return 1;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    ureg_set set, other;
+    pid_t pid;
+    int res, status;
+
+    if (argc < 4 || strlen(argv[2]) != (size_t)(argc - 3))
+        exit(1);
+    set = ureg_set_compile((const char *const *)argv + 3, argc - 3, 0);
+    if (set == NULL)
+        exit(1);
+    res = check(set, argv[1], argv[2]);
+
+    /* Inherited by a forked worker */
+    if ((pid = fork()) < 0)
+        exit(1);
+    if (pid == 0)
+        _exit(check(set, argv[1], argv[2]));
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        res = 1;
+
+    /* Mapped again through its descriptor */
+    if (ureg_set_fd(set) >= 0)
+    {
+        if ((other = ureg_set_open(ureg_set_fd(set))) == NULL)
+            exit(1);
+        res |= check(other, argv[1], argv[2]);
+        ureg_set_free(other);
+    }
+
+    ureg_set_free(set);
+    exit(res);
+}
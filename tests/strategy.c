@@ -0,0 +1,130 @@
+/* Test runner for the choice of engines: patterns get the engines they
+ * are meant to, loaded regexps the same ones as compiled regexps
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "setup.h"
+#include "ureg.h"
+
+/* Platforms jit.c generates code for: there, native code must be used */
+#if defined(UREG_JIT_X86_64) && (defined(__x86_64__) || defined(__amd64__))
+#define NATIVE  1
+#endif
+
+#define N   UREG_ENGINE_NONE
+#define V   UREG_ENGINE_NFA
+#define B   UREG_ENGINE_BACKTRACK
+#define O   UREG_ENGINE_ONEPASS
+#define P   UREG_ENGINE_PIKEVM
+#define L   UREG_ENGINE_LITERAL
+#define R   UREG_ENGINE_REVERSE
+
+static const struct
+{
+    const char *re;
+    unsigned int flags;
+    ureg_engine_t match, shortmatch, capture, shortcapture;
+    unsigned int props;
+} cases[] = {
+    { "hello", 0, L, L, N, N, UREG_PROP_LITERAL },
+    { "hello", UREG_NOOPT_STRING, V, B, N, N, 0 },
+    { "foo|b\\.r", UREG_CAPTURE, L, L, L, L, UREG_PROP_CAPTURE | UREG_PROP_LITERAL },
+    { "(?:hello)", 0, V, B, N, N, 0 },
+    { "g.*bye", UREG_CAPTURE, L, L, L, L, UREG_PROP_CAPTURE | UREG_PROP_GAP },
+    { "g.{2,8}bye", UREG_ANCHORED, L, L, N, N, UREG_PROP_ANCHORED | UREG_PROP_GAP },
+    { "g.*?bye", 0, R, B, N, N, UREG_PROP_SUFFIX },
+    { "g.*?bye", UREG_NOOPT_STRING, V, B, N, N, 0 },
+    { "[a-z]+ing[a-z]*", 0, R, B, N, N, UREG_PROP_INNER },
+    { "[a-z]+ing[a-z]*", UREG_ANCHORED, V, B, N, N, UREG_PROP_ANCHORED },
+    { "(a+)(b)", UREG_CAPTURE, V, B, P, B, UREG_PROP_CAPTURE },
+    { "(a+)(b)", UREG_CAPTURE | UREG_ANCHORED, V, B, O, O,
+      UREG_PROP_CAPTURE | UREG_PROP_ANCHORED | UREG_PROP_ONEPASS },
+    { "([a-z]+)=([0-9]*)", UREG_CAPTURE | UREG_ANCHORED, V, B, O, O,
+      UREG_PROP_CAPTURE | UREG_PROP_ANCHORED | UREG_PROP_ONEPASS },
+    { "x(a|ab)(c|bcd)", UREG_CAPTURE | UREG_ANCHORED, V, B, P, B,
+      UREG_PROP_CAPTURE | UREG_PROP_ANCHORED },
+    { "(?:hello|goodbye) world", UREG_ANCHORED, V, B, N, N, UREG_PROP_ANCHORED }
+};
+#define NCASES  (sizeof(cases)/sizeof(cases[0]))
+
+static const unsigned int jitflags[] = { UREG_JIT, UREG_JIT | UREG_ANCHORED };
+#define NJITFLAGS   (sizeof(jitflags)/sizeof(jitflags[0]))
+
+static int check(ureg_regexp r, int i)
+{
+    ureg_strategy s;
+
+    ureg_getstrategy(r, &s);
+    if (ureg_errno != UREG_NOERROR || s.size == 0)
+        return 1;
+    /* Short inputs only differ when they have engines of their own */
+    if ((s.shortmax == 0) != (s.shortmatch == s.match && s.shortcapture == s.capture))
+        return 1;
+    return s.match != cases[i].match || s.shortmatch != cases[i].shortmatch ||
+           s.capture != cases[i].capture || s.shortcapture != cases[i].shortcapture ||
+           s.props != cases[i].props;
+}
+
+int main(void)
+{
+    ureg_strategy s;
+    ureg_regexp r, l;
+    char buf[4096];
+    size_t n;
+    int i, res = 0;
+
+    for (i = 0; i < (int)NCASES; i++)
+    {
+        if ((r = ureg_compile(cases[i].re, cases[i].flags)) == NULL)
+            exit(1);
+        res |= check(r, i);
+        n = ureg_serialize(r, buf, sizeof(buf));
+        if (n == 0 || n > sizeof(buf) || (l = ureg_load(buf, n)) == NULL)
+            exit(1);
+        res |= check(l, i);
+        ureg_free(l);
+        ureg_free(r);
+        if (res)
+        {
+            fprintf(stderr, "/%s/ flags %#x\n", cases[i].re, cases[i].flags);
+            break;
+        }
+    }
+
+    /* Native code runs inputs of any length, anchored or not, when
+     * there is some
+     */
+    for (i = 0; i < (int)NJITFLAGS; i++)
+    {
+        if ((r = ureg_compile("(?:hello|goodbye) world", jitflags[i])) == NULL)
+            exit(1);
+        ureg_getstrategy(r, &s);
+#ifdef NATIVE
+        res |= s.match != UREG_ENGINE_JIT || s.shortmatch != UREG_ENGINE_JIT;
+#else
+        res |= s.match == UREG_ENGINE_JIT;
+#endif
+        ureg_free(r);
+    }
+
+    /* Except for strings, which are searched for directly */
+    if ((r = ureg_compile("hello world", UREG_JIT)) == NULL)
+        exit(1);
+    ureg_getstrategy(r, &s);
+    res |= s.match != UREG_ENGINE_LITERAL;
+    ureg_free(r);
+
+    /* The bitmap knows nothing of counters */
+    if ((r = ureg_compile("x[a-z]{500}y", 0)) == NULL)
+        exit(1);
+    ureg_getstrategy(r, &s);
+    res |= (s.props & UREG_PROP_COUNTERS) && s.shortmatch != UREG_ENGINE_NFA;
+    ureg_free(r);
+
+    ureg_getstrategy(NULL, &s);
+    res |= ureg_errno != UREG_ERR_NULL;
+    res |= strcmp(ureg_engine_name(UREG_ENGINE_ONEPASS), "onepass") != 0;
+    res |= ureg_engine_name((ureg_engine_t)99) != NULL;
+    exit(res);
+}
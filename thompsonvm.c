@@ -12,11 +12,23 @@ typedef struct Thread Thread;
 struct Thread
 {
     Inst *pc;
+    /* String: bytes already matched */
+    int k;
 };
 
+/* Thread lists are sparse sets over instruction indices (Briggs and
+ * Torczon): t[] is the dense part and sparse[i] the slot of instruction
+ * i, if it is on the list. Membership tests and clearing take constant
+ * time, and matching never writes into the (shared) program.
+ */
 typedef struct ThreadList ThreadList;
 struct ThreadList
 {
+    /* Counters of the Repeat instructions on the list */
+    CountWord *cnt;
+    /* Work stack of addthread(), shared by both lists */
+    int *stack;
+    int *sparse;
     int n;
     Thread t[1];
 };
@@ -24,100 +36,597 @@ struct ThreadList
 static Thread
 thread(Inst *pc)
 {
-    Thread t = {pc};
+    Thread t;
+
+    t.pc = pc;
+    t.k = 0;
     return t;
 }
 
+/* Is instruction i on l? Only threads entering an instruction (k == 0)
+ * are members: threads within a literal are copied from list to list
+ * and never looked up.
+ */
+static int
+onlist(Prog *p, ThreadList *l, int i)
+{
+    unsigned int s = (unsigned int)l->sparse[i];
+
+    return s < (unsigned int)l->n && l->t[s].pc == p->start + i && l->t[s].k == 0;
+}
+
 static void
-addthread(ThreadList *l, Thread t, int gen)
+addlist(Prog *p, ThreadList *l, int i)
 {
-    if(t.pc->gen == gen)
-        return;
-    t.pc->gen = gen;
-    l->t[l->n] = t;
+    l->sparse[i] = l->n;
+    l->t[l->n] = thread(p->start + i);
     l->n++;
+}
 
-    switch(t.pc->opcode)
+/* Can a thread at pc get past the next input byte la? With UREG_LOOKAHEAD
+ * threads are pruned when they are added, a step early; la is -1 when
+ * it is off. Mirrors the matching of the consuming instructions below.
+ */
+static int
+viable(Prog *p, Inst *pc, int la)
+{
+    char c = (char)la;
+
+    if(la < 0)
+        return 1;
+    switch(pc->opcode)
     {
-        case Jmp:
-            addthread(l, thread(t.pc->x), gen);
-            break;
-        case Split:
-            addthread(l, thread(t.pc->x), gen);
-            addthread(l, thread(t.pc->y), gen);
-            break;
-        case Save:
-            addthread(l, thread(t.pc+1), gen);
-            break;
+        case Char:
+            return c == pc->c;
+        case Rng:
+            return la != 0 && c >= pc->lo && c <= pc->hi;
+        case Any:
+            return la != 0;
+        case Set:
+            return CLASSHAS(PROGCLASS(p, pc->y), la) != 0;
+        case String:
+            return c == PROGSTR(p)[pc->y];
+    }
+    return 1;
+}
+
+/* Instruction dispatch.
+ *
+ * When the compiler supports labels as values every opcode handler ends
+ * with its own indirect jump to the next handler (threaded code), which
+ * gives the branch predictor one history slot per opcode instead of a
+ * single, hard to predict, switch jump. Otherwise fall back to a plain
+ * switch statement. Handlers are written with the same macros in both
+ * cases: OP(x) opens the handler for opcode x.
+ */
+#ifdef UREG_COMPUTED_GOTO
+# define OPTABLE(name)                                                  \
+    static void *const name[] = {                                       \
+        &&op_default, &&op_Char, &&op_Match, &&op_Jmp, &&op_Split,      \
+        &&op_Any, &&op_Save, &&op_Rng, &&op_Repeat, &&op_Set,           \
+        &&op_String                                                     \
+    }
+# define DISPATCH(table, op)    goto *table[(op)];
+# define OP(x)                  op_##x
+# define OP_DEFAULT             op_default
+#else
+# define OPTABLE(name)          /* nothing */
+# define DISPATCH(table, op)    switch (op)
+# define OP(x)                  case x
+# define OP_DEFAULT             default
+#endif /* UREG_COMPUTED_GOTO */
+
+/* Put Repeat pc on list l, clearing its counters the first time it is
+ * added. Returns the counters.
+ */
+static CountWord*
+touch(Prog *p, ThreadList *l, Inst *pc)
+{
+    int i = pc - p->start;
+    RepeatArgs *a = PROGREPEAT(p, pc->y);
+    CountWord *cnt = l->cnt + a->cnt;
+
+    if(!onlist(p, l, i))
+    {
+        addlist(p, l, i);
+        memset(cnt, '\0', REPEATWORDS(pc, a)*sizeof(CountWord));
+    }
+    return cnt;
+}
+
+/* Add the instructions of a precomputed epsilon closure: a count, the
+ * first-byte set, then the indices
+ */
+static void
+addclosure(Prog *p, ThreadList *l, const int *clos, int la)
+{
+    const int *end = clos + 2 + clos[0];
+    Inst *pc;
+
+    if(la >= 0 && clos[1] >= 0 && !CLASSHAS(PROGCLASS(p, clos[1]), la))
+        return;
+    for(clos += 2; clos < end; clos++)
+    {
+        pc = p->start + *clos;
+        /* The continuation of a Repeat is already in the closure */
+        if(pc->opcode == Repeat)
+            touch(p, l, pc)[0] |= 1;
+        else if(!onlist(p, l, *clos) && viable(p, pc, la))
+            addlist(p, l, *clos);
+    }
+}
+
+/* Add t and everything reachable from it through epsilon transitions,
+ * in the order of a depth-first walk taking x before y.
+ *
+ * The walk uses l->stack instead of recursion. Only a Split pushes more
+ * than it pops, once per list, so len + 1 entries always do.
+ */
+static void
+addthread(Prog *p, ThreadList *l, Thread t, int la)
+{
+    int *stack = l->stack;
+    int i, n;
+    OPTABLE(epsilon);
+
+    stack[0] = t.pc - p->start;
+    for(n = 1; n > 0; )
+    {
+        i = stack[--n];
+        t = thread(p->start + i);
+        /* A Repeat may be entered again after its counters have been
+         * updated on this list
+         */
+        if(t.pc->opcode == Repeat)
+        {
+            touch(p, l, t.pc)[0] |= 1;
+            if(PROGREPEAT(p, t.pc->y)->lo == 0)
+                stack[n++] = t.pc->x;
+            continue;
+        }
+        if(p->nclosure > 0 && PROGCLOSURE(p)[i] >= 0)
+        {
+            addclosure(p, l, PROGCLOSURE(p) + PROGCLOSURE(p)[i], la);
+            continue;
+        }
+        if(onlist(p, l, i) || !viable(p, t.pc, la))
+            continue;
+        addlist(p, l, i);
+
+        DISPATCH(epsilon, t.pc->opcode)
+        {
+            OP(Jmp):
+                stack[n++] = t.pc->x;
+                continue;
+            OP(Split):
+                stack[n++] = t.pc->y;
+                stack[n++] = t.pc->x;
+                continue;
+            OP(Save):
+                stack[n++] = i + 1;
+                continue;
+            OP(Char):
+            OP(Match):
+            OP(Any):
+            OP(Rng):
+            OP(Repeat):
+            OP(Set):
+            OP(String):
+            OP_DEFAULT:
+                continue;
+        }
+    }
+}
+
+/* Is any of the bits from..to-1 of v set? */
+static int
+anybits(const CountWord *v, int from, int to)
+{
+    const int nb = (int)COUNTBITS;
+    CountWord m;
+    int w;
+
+    if(from < 0)
+        from = 0;
+    for(w = from / nb; w*nb < to; w++)
+    {
+        m = ~(CountWord)0;
+        if(w == from / nb)
+            m &= ~(CountWord)0 << (from % nb);
+        if((w + 1)*nb > to)
+            m &= ~(~(CountWord)0 << (to % nb));
+        if(v[w] & m)
+            return 1;
     }
+    return 0;
 }
 
-static ThreadList*
-threadlist(size_t len)
+/* Does body instruction pc accept c (which is not NUL)? */
+static int
+bodyaccepts(Prog *p, Inst *pc, char c)
 {
-    return (ThreadList *)malloc(sizeof(ThreadList) + len*sizeof(Thread));
+    switch(pc->opcode)
+    {
+        case Char:
+            return c == pc->c;
+        case Rng:
+            return c >= pc->lo && c <= pc->hi;
+        case Any:
+            return 1;
+        case Set:
+            return CLASSHAS(PROGCLASS(p, pc->y), c) != 0;
+    }
+    return 0;
+}
+
+/* Advance the counters of Repeat pc from clist to nlist over c */
+static void
+repeatstep(Prog *p, ThreadList *clist, ThreadList *nlist, Inst *pc, char c,
+           int la)
+{
+    RepeatArgs *a = PROGREPEAT(p, pc->y);
+    int stride = REPEATSTRIDE(a), bits = REPEATBITS(a), last = pc->n - 1;
+    CountWord *src, *dst, v, carry;
+    Inst *b = pc + 1, *end = p->start + pc->x;
+    int k, w, ok;
+
+    if(c == '\0')
+        return;
+    for(k = 0; k <= last; k++)
+    {
+        for(ok = 0; b < end && b->n == k; b++)
+            if(!ok && bodyaccepts(p, b, c))
+                ok = 1;
+        src = clist->cnt + a->cnt + k*stride;
+        if(!ok || !anybits(src, 0, bits))
+            continue;
+        if(k < last)
+        {
+            /* Same count, next position */
+            dst = touch(p, nlist, pc) + (k + 1)*stride;
+            for(w = 0; w < stride; w++)
+                dst[w] |= src[w];
+            continue;
+        }
+
+        /* One more iteration: leave if enough have been matched... */
+        if(anybits(src, a->lo - 1, bits))
+            addthread(p, nlist, thread(p->start + pc->x), la);
+        /* ...and go around again unless the upper bound has been hit */
+        if(a->hi >= 0 && !anybits(src, 0, bits - 1))
+            continue;
+        dst = touch(p, nlist, pc);
+        for(carry = 0, w = 0; w < stride; w++)
+        {
+            v = src[w];
+            dst[w] |= (v << 1) | carry;
+            carry = v >> (COUNTBITS - 1);
+        }
+        w = (bits - 1) / (int)COUNTBITS;
+        if((bits - 1) % (int)COUNTBITS != (int)COUNTBITS - 1)
+            dst[w] &= ~(~(CountWord)0 << ((bits - 1) % (int)COUNTBITS + 1));
+        if(a->hi < 0 && anybits(src, bits - 1, bits))
+            dst[w] |= (CountWord)1 << ((bits - 1) % (int)COUNTBITS);
+    }
 }
 
+/* Scratch layout: the addthread() stack, the sparse arrays of both
+ * thread lists, then the lists and their counters. Besides one thread
+ * per instruction, a list may hold one thread per byte of a literal.
+ */
+#define SCRATCH_ROUND(n)    (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+#define STACKSIZE(len)      SCRATCH_ROUND(((len) + 1)*sizeof(int))
+#define SPARSESIZE(len)     SCRATCH_ROUND((len)*sizeof(int))
+#define LISTSIZE(n)         SCRATCH_ROUND(sizeof(ThreadList) + (n)*sizeof(Thread))
+#define CNTSIZE(n)          SCRATCH_ROUND((n)*sizeof(CountWord))
+
 int
-thompsonvm(Prog *prog, const char *input)
+thompsonvm(Prog *prog, const char *input, ureg_matcher m, int lookahead)
 {
-    int i, len, matched, gen;
+    char *mem, *lists;
+    int i, len, nt, matched, la;
     ThreadList *clist, *nlist, *tmp;
     Inst *pc;
     const char *sp;
+    OPTABLE(step);
 
     len = prog->len;
-    clist = threadlist(len);
-    nlist = threadlist(len);
-
-    if (clist == NULL || nlist == NULL)
+    nt = len + prog->nstr;
+    mem = (char *)matcherscratch(m, STACKSIZE(len) + 2*SPARSESIZE(len) +
+                                    2*LISTSIZE(nt) +
+                                    2*CNTSIZE((size_t)prog->ncount));
+    if (mem == NULL)
     {
         ureg_errno = UREG_ERR_NOMEM;
         return -1;
     }
+    lists = mem + STACKSIZE(len) + 2*SPARSESIZE(len);
+    clist = (ThreadList *)lists;
+    nlist = (ThreadList *)(lists + LISTSIZE(nt));
+    clist->cnt = (CountWord *)(lists + 2*LISTSIZE(nt));
+    nlist->cnt = (CountWord *)((char *)clist->cnt + CNTSIZE((size_t)prog->ncount));
+    clist->stack = nlist->stack = (int *)mem;
+    /* Left as found: onlist() checks whatever sparse[] holds against the
+     * dense part, so emptying a list is just n = 0 (the scratch memory
+     * comes zeroed, so nothing read is uninitialized)
+     */
+    clist->sparse = (int *)(mem + STACKSIZE(len));
+    nlist->sparse = (int *)(mem + STACKSIZE(len) + SPARSESIZE(len));
     clist->n = nlist->n = 0;
 
-    gen = 1;
-    addthread(clist, thread(prog->start), gen);
+    addthread(prog, clist, thread(prog->start), lookahead ? (unsigned char)*input : -1);
     matched = 0;
     for(sp = input; ; sp++)
     {
         if(clist->n == 0)
             break;
-        gen++;
+        /* Threads are only added to nlist past a byte which is not NUL */
+        la = lookahead && *sp != '\0' ? (unsigned char)sp[1] : -1;
+        /* NEXT jumps straight into the handler for the next thread when
+         * threaded dispatch is available, and re-enters the switch
+         * otherwise.
+         */
+#ifdef UREG_COMPUTED_GOTO
+# define NEXT()                                                         \
+        do {                                                            \
+            if(++i >= clist->n)                                         \
+                goto BreakFor;                                          \
+            pc = clist->t[i].pc;                                        \
+            DISPATCH(step, pc->opcode);                                 \
+        } while(0)
+        i = 0;
+        pc = clist->t[0].pc;
+#else
+# define NEXT()                 continue
         for(i = 0; i < clist->n; i++)
+#endif /* UREG_COMPUTED_GOTO */
         {
+#ifndef UREG_COMPUTED_GOTO
             pc = clist->t[i].pc;
-            switch(pc->opcode)
+#endif
+            DISPATCH(step, pc->opcode)
+            {
+                OP(Char):
+                    if(*sp == pc->c)
+                        addthread(prog, nlist, thread(pc+1), la);
+                    NEXT();
+                OP(Rng):
+                    if(*sp < pc->lo || *sp > pc->hi)
+                        NEXT();
+                    /* Fall through */
+                OP(Any):
+                    if(*sp != '\0')
+                        addthread(prog, nlist, thread(pc+1), la);
+                    NEXT();
+                OP(Set):
+                    /* NUL is never in the set */
+                    if(CLASSHAS(PROGCLASS(prog, pc->y), *sp))
+                        addthread(prog, nlist, thread(pc+1), la);
+                    NEXT();
+                OP(String):
+                    /* Literals hold no NUL. Threads within a literal
+                     * all entered it at distinct input positions, so
+                     * they need no deduplication.
+                     */
+                    if(*sp != PROGSTR(prog)[pc->y + clist->t[i].k])
+                        NEXT();
+                    if(clist->t[i].k + 1 == pc->n)
+                        addthread(prog, nlist, thread(pc+1), la);
+                    else if(la < 0 || (char)la == PROGSTR(prog)[pc->y + clist->t[i].k + 1])
+                    {
+                        nlist->t[nlist->n] = clist->t[i];
+                        nlist->t[nlist->n].k++;
+                        nlist->n++;
+                    }
+                    NEXT();
+                OP(Repeat):
+                    repeatstep(prog, clist, nlist, pc, *sp, la);
+                    NEXT();
+                OP(Match):
+                    matched = 1;
+                    goto BreakFor;      /* I know, it's ugly. Sue me */
+                OP(Jmp):
+                OP(Split):
+                OP(Save):
+                OP_DEFAULT:
+                    NEXT();
+            }
+        }
+#undef NEXT
+BreakFor:
+        /* Exit loop on string end or positive match */
+        if(*sp == '\0' || matched)
+            break;
+        tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+        nlist->n = 0;
+    }
+    return matched;
+}
+
+/* Submatch extraction (Pike's VM).
+ *
+ * Same lockstep simulation as thompsonvm(), except that every thread
+ * carries the positions recorded by the Save instructions it went
+ * through, nslot words in cap[] at the index of its slot in the list.
+ * Lists are kept in priority order: addcapthread() walks x before y
+ * and the first thread to reach an instruction owns it. Once a thread
+ * matches the threads after it are dropped, so the match reported when
+ * no thread is left is the leftmost-first one. Closures, lookahead and
+ * counters are not used: programs compiled for captures have no Repeat
+ * (a thread reaching one just dies).
+ */
+
+/* Add the thread at instruction i, with positions cap, to l. cap is
+ * updated in place by Save instructions during the walk and restored
+ * when it is over.
+ *
+ * The stack holds pairs: an instruction to visit with 0, or the slot
+ * to restore (as -1 - slot) with its old value. A Save pushes two
+ * pairs, a Split two and every other instruction at most one, once per
+ * list, so 2*len + 1 pairs always do.
+ */
+static void
+addcapthread(Prog *p, ThreadList *l, int *lcap, int i, int *cap, int nslot,
+             int pos)
+{
+    int *stack = l->stack;
+    Inst *pc;
+    int n, v;
+
+    stack[0] = i;
+    stack[1] = 0;
+    for (n = 2; n > 0; )
+    {
+        n -= 2;
+        i = stack[n];
+        v = stack[n + 1];
+        if (i < 0)
+        {
+            cap[-1 - i] = v;
+            continue;
+        }
+        if (onlist(p, l, i))
+            continue;
+        addlist(p, l, i);
+        pc = p->start + i;
+        switch (pc->opcode)
+        {
+            case Jmp:
+                stack[n++] = pc->x;
+                stack[n++] = 0;
+                break;
+            case Split:
+                stack[n++] = pc->y;
+                stack[n++] = 0;
+                stack[n++] = pc->x;
+                stack[n++] = 0;
+                break;
+            case Save:
+                stack[n++] = -1 - pc->n;
+                stack[n++] = cap[pc->n];
+                cap[pc->n] = pos;
+                stack[n++] = i + 1;
+                stack[n++] = 0;
+                break;
+            default:
+                memcpy(lcap + (size_t)(l->n - 1)*nslot, cap, (size_t)nslot*sizeof(int));
+                break;
+        }
+    }
+}
+
+/* Scratch layout: the addcapthread() stack, the sparse arrays and the
+ * lists, the positions of their threads, then those of the start thread
+ * and of the match
+ */
+#define CAPSTACKSIZE(len)   SCRATCH_ROUND(2*(2*(size_t)(len) + 1)*sizeof(int))
+#define CAPSIZE(n, nslot)   SCRATCH_ROUND((size_t)(n)*(nslot)*sizeof(int))
+
+/* Find the leftmost-first match of prog in input. Returns 1 on match,
+ * with the first ncap groups in caps.
+ */
+int
+pikevm(Prog *prog, const char *input, int *caps, int ncap, ureg_matcher m)
+{
+    char *mem, *lists;
+    int i, len, nt, nslot, matched;
+    int *cpos, *npos, *tpos, *best;
+    ThreadList *clist, *nlist, *tmp;
+    Thread *t;
+    Inst *pc;
+    const char *sp;
+
+    len = prog->len;
+    nt = len + prog->nstr;
+    for (nslot = 0, i = 0; i < len; i++)
+        if (prog->start[i].opcode == Save && prog->start[i].n >= nslot)
+            nslot = prog->start[i].n + 1;
+    nslot += nslot & 1;
+    mem = (char *)matcherscratch(m, CAPSTACKSIZE(len) + 2*SPARSESIZE(len) +
+                                    2*LISTSIZE(nt) + 2*CAPSIZE(nt, nslot) +
+                                    2*CAPSIZE(1, nslot) + sizeof(int));
+    if (mem == NULL)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        return -1;
+    }
+    lists = mem + CAPSTACKSIZE(len) + 2*SPARSESIZE(len);
+    clist = (ThreadList *)lists;
+    nlist = (ThreadList *)(lists + LISTSIZE(nt));
+    cpos = (int *)(lists + 2*LISTSIZE(nt));
+    npos = (int *)((char *)cpos + CAPSIZE(nt, nslot));
+    tpos = (int *)((char *)npos + CAPSIZE(nt, nslot));
+    best = (int *)((char *)tpos + CAPSIZE(1, nslot));
+    clist->cnt = nlist->cnt = NULL;
+    clist->stack = nlist->stack = (int *)mem;
+    clist->sparse = (int *)(mem + CAPSTACKSIZE(len));
+    nlist->sparse = (int *)(mem + CAPSTACKSIZE(len) + SPARSESIZE(len));
+    clist->n = nlist->n = 0;
+
+    for (i = 0; i < nslot; i++)
+        tpos[i] = -1;
+    addcapthread(prog, clist, cpos, 0, tpos, nslot, 0);
+    matched = 0;
+    for (sp = input; clist->n > 0; sp++)
+    {
+        for (i = 0; i < clist->n; i++)
+        {
+            t = clist->t + i;
+            pc = t->pc;
+            tpos = cpos + (size_t)i*nslot;
+            switch (pc->opcode)
             {
                 case Char:
-                    if(*sp != pc->c)
-                        break;
-                    addthread(nlist, thread(pc+1), gen);
+                    if (*sp != pc->c)
+                        continue;
                     break;
                 case Rng:
-                    if(*sp < pc->lo || *sp > pc->hi)
-                        break;
+                    if (*sp < pc->lo || *sp > pc->hi)
+                        continue;
+                    /* Fall through */
                 case Any:
-                    if(*sp == '\0')
-                        break;
-                    addthread(nlist, thread(pc+1), gen);
+                    if (*sp == '\0')
+                        continue;
                     break;
+                case Set:
+                    if (!CLASSHAS(PROGCLASS(prog, pc->y), *sp))
+                        continue;
+                    break;
+                case String:
+                    if (*sp != PROGSTR(prog)[pc->y + t->k])
+                        continue;
+                    if (t->k + 1 == pc->n)
+                        break;
+                    nlist->t[nlist->n] = *t;
+                    nlist->t[nlist->n].k++;
+                    memcpy(npos + (size_t)nlist->n*nslot, tpos, (size_t)nslot*sizeof(int));
+                    nlist->n++;
+                    continue;
                 case Match:
+                    memcpy(best, tpos, (size_t)nslot*sizeof(int));
                     matched = 1;
-                    goto BreakFor;      /* I know, it's ugly. Sue me */
+                    /* Lower priority threads are cut off */
+                    i = clist->n;
+                    continue;
+                default:
+                    continue;
             }
+            addcapthread(prog, nlist, npos, (int)(pc - prog->start) + 1, tpos,
+                         nslot, (int)(sp - input) + 1);
         }
-BreakFor:
-        /* Exit loop on string end or positive match */
-        if(*sp == '\0' || matched)
+        if (*sp == '\0')
             break;
         tmp = clist;
         clist = nlist;
         nlist = tmp;
+        tpos = cpos;
+        cpos = npos;
+        npos = tpos;
         nlist->n = 0;
     }
-    free(clist);
-    free(nlist);
+    for (i = 0; matched && i < 2*ncap; i++)
+        caps[i] = i < nslot ? best[i] : -1;
     return matched;
 }
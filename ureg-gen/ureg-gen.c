@@ -0,0 +1,244 @@
+/* ureg-gen - ahead-of-time compiler for libureg patterns
+ *
+ * Copyright 2010 Matteo Panella. All Rights Reserved.
+ * Based on code by Russ Cox.
+ * Use of this code is governed by a BSD-style license
+ *
+ * Usage: ureg-gen [-m maxstates] input.ureg output.c output.h
+ *
+ * Every non-empty line of the input not starting with '#' declares a
+ * matcher as "name pattern": name must be a valid C identifier and the
+ * pattern extends from the first non-blank character after it up to the
+ * end of the line. For each matcher a function
+ *
+ *      int name(const char *s);
+ *
+ * is generated, returning 1 if s matches the pattern and 0 otherwise,
+ * exactly like ureg_match(). The pattern is compiled into a DFA which is
+ * emitted as a goto-based state machine, so no setup is required at
+ * runtime.
+ */
+
+#include "stdinc.h"
+#include <ctype.h>
+#include "ureg.h"
+#define UREG_INTERNAL
+#include "ureg-internal.h"
+
+/* Default upper bound of DFA states per pattern */
+#define GEN_MAXSTATE    10000
+
+static const char *progname = "ureg-gen";
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-m maxstates] input.ureg output.c output.h\n", progname);
+    exit(1);
+}
+
+/* Print a C comment body, making sure the pattern cannot close it */
+static void
+putcomment(FILE *f, const char *s)
+{
+    for (; *s; s++)
+    {
+        if (s[0] == '*' && s[1] == '/')
+            fputs("*\\", f);
+        else
+            fputc(*s, f);
+    }
+}
+
+static void
+puttarget(FILE *f, int t)
+{
+    if (t == DfaMatch)
+        fprintf(f, "return 1;");
+    else if (t == DfaDead)
+        fprintf(f, "return 0;");
+    else
+        fprintf(f, "goto s%d;", t);
+}
+
+/* Emit the state machine for d as function name */
+static void
+genmatcher(FILE *f, const char *name, const char *pattern, Dfa *d)
+{
+    int target[256], count[256];
+    int *row, s, c, i, n, def;
+
+    fprintf(f, "/* ");
+    putcomment(f, pattern);
+    fprintf(f, " */\nint\n%s(const char *s)\n{\n", name);
+    if (d->start == DfaMatch)
+    {
+        fprintf(f, "    (void)s;\n    return 1;\n}\n\n");
+        return;
+    }
+    fprintf(f, "    const unsigned char *p = (const unsigned char *)s;\n\n");
+    fprintf(f, "    goto s%d;\n", d->start);
+    for (s = 0; s < d->nstate; s++)
+    {
+        row = d->trans + s*256;
+        /* The most frequent successor becomes the default label */
+        n = 0;
+        for (c = 0; c < 256; c++)
+        {
+            for (i = 0; i < n && target[i] != row[c]; i++)
+                ;
+            if (i == n)
+            {
+                target[n] = row[c];
+                count[n++] = 0;
+            }
+            count[i]++;
+        }
+        for (def = 0, i = 1; i < n; i++)
+            if (count[i] > count[def])
+                def = i;
+        def = target[def];
+        fprintf(f, "s%d:\n    switch (*p++)\n    {\n", s);
+        for (c = 0; c < 256; c++)
+        {
+            if (row[c] == def)
+                continue;
+            fprintf(f, "        case 0x%02x: ", c);
+            for (; c < 255 && row[c + 1] == row[c]; c++)
+                fprintf(f, "case 0x%02x: ", c + 1);
+            puttarget(f, row[c]);
+            fprintf(f, "\n");
+        }
+        fprintf(f, "        default: ");
+        puttarget(f, def);
+        fprintf(f, "\n    }\n");
+    }
+    fprintf(f, "}\n\n");
+}
+
+static int
+validname(const char *s)
+{
+    if (!isalpha((unsigned char)*s) && *s != '_')
+        return 0;
+    for (; *s; s++)
+        if (!isalnum((unsigned char)*s) && *s != '_')
+            return 0;
+    return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *in, *outc, *outh;
+    char line[4096], guard[256];
+    char *name, *pattern, *e;
+    const char *hbase, *p;
+    Regexp *r;
+    Arena arena;
+    Prog *prog;
+    Dfa *d;
+    int maxstate = GEN_MAXSTATE;
+    int lineno = 0, errors = 0, i;
+
+    if (argc > 0)
+        progname = argv[0];
+    if (argc == 6 && strcmp(argv[1], "-m") == 0)
+    {
+        maxstate = (int)strtol(argv[2], &e, 10);
+        if (*e != '\0' || maxstate <= 0)
+            usage();
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 4)
+        usage();
+
+    if ((in = fopen(argv[1], "r")) == NULL)
+    {
+        fprintf(stderr, "%s: cannot open %s\n", progname, argv[1]);
+        return 1;
+    }
+    outc = fopen(argv[2], "w");
+    outh = fopen(argv[3], "w");
+    if (outc == NULL || outh == NULL)
+    {
+        fprintf(stderr, "%s: cannot create output files\n", progname);
+        return 1;
+    }
+
+    /* Header guard from the header file name */
+    hbase = strrchr(argv[3], '/');
+    hbase = hbase ? hbase + 1 : argv[3];
+    strcpy(guard, "INCLUDED_");
+    for (i = strlen(guard); *hbase && i < (int)sizeof(guard) - 1; hbase++)
+        guard[i++] = isalnum((unsigned char)*hbase) ? *hbase : '_';
+    guard[i] = '\0';
+
+    fprintf(outh, "/* Generated by ureg-gen from %s - do not edit */\n\n", argv[1]);
+    fprintf(outh, "#ifndef %s\n#define %s\n\n", guard, guard);
+    fprintf(outc, "/* Generated by ureg-gen from %s - do not edit */\n\n", argv[1]);
+    p = strrchr(argv[3], '/');
+    fprintf(outc, "#include \"%s\"\n\n", p ? p + 1 : argv[3]);
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        for (name = line; isspace((unsigned char)*name); name++)
+            ;
+        if (*name == '\0' || *name == '#')
+            continue;
+        for (pattern = name; *pattern && !isspace((unsigned char)*pattern); pattern++)
+            ;
+        if (*pattern)
+            *pattern++ = '\0';
+        while (isspace((unsigned char)*pattern))
+            pattern++;
+        if (!validname(name))
+        {
+            fprintf(stderr, "%s:%d: invalid matcher name \"%s\"\n", argv[1], lineno, name);
+            errors++;
+            continue;
+        }
+
+        arenainit(&arena, curalloc(), NULL);
+        if ((r = parse(pattern, &arena, 0)) == NULL)
+        {
+            fprintf(stderr, "%s:%d: syntax error in \"%s\"\n", argv[1], lineno, pattern);
+            arenafree(&arena);
+            errors++;
+            continue;
+        }
+        /* The DFA cannot represent counters */
+        r = optimize(&arena, r, 0);
+        expand_counts(&arena, r);
+        prog = compile(r, &arena, 0);
+        d = dfabuild(prog, maxstate, curalloc());
+        arenafree(&arena);
+        if (d == NULL)
+        {
+            fprintf(stderr, "%s:%d: \"%s\" needs more than %d DFA states\n",
+                    argv[1], lineno, pattern, maxstate);
+            errors++;
+            continue;
+        }
+        fprintf(outh, "/* ");
+        putcomment(outh, pattern);
+        fprintf(outh, " */\nextern int %s(const char *);\n", name);
+        genmatcher(outc, name, pattern, d);
+        ufree(curalloc(), d);
+    }
+    fprintf(outh, "\n#endif /* %s */\n", guard);
+
+    fclose(in);
+    fclose(outc);
+    fclose(outh);
+    if (errors)
+    {
+        remove(argv[2]);
+        remove(argv[3]);
+        return 1;
+    }
+    return 0;
+}
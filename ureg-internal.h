@@ -16,32 +16,94 @@ typedef struct Regexp Regexp;
 typedef struct Prog Prog;
 typedef struct Inst Inst;
 typedef struct Parse Parse;
+typedef struct Arena Arena;
+typedef struct ArenaChunk ArenaChunk;
+
+/* Allocation hooks, see alloc.c */
+extern const ureg_allocator *curalloc(void);
+extern void *ualloc(const ureg_allocator *, size_t);
+extern void *ucalloc(const ureg_allocator *, size_t);
+extern void *urealloc(const ureg_allocator *, void *, size_t, size_t);
+extern void ufree(const ureg_allocator *, void *);
+extern void *ulinealloc(const ureg_allocator *, size_t, void **);
+
+/* Scratch memory for matching, reused across calls */
+struct ureg_matcher_t
+{
+    ureg_allocator alloc;
+    void *mem;
+    size_t size;
+};
+
+extern void *matcherscratch(ureg_matcher, size_t);
+extern void *matchergrow(ureg_matcher, size_t);
+
+/* Bump allocator, see arena.c */
+struct Arena
+{
+    const ureg_allocator *alloc;
+    ArenaChunk *chunks;
+    char *next;
+    size_t avail;
+    size_t chunksize;
+    /* Where to go when the allocator fails, NULL to exit (see fatal()) */
+    jmp_buf *oom;
+};
+
+extern void arenainit(Arena *, const ureg_allocator *, jmp_buf *);
+extern void *arenaalloc(Arena *, size_t);
+extern void *arenagrow(Arena *, void *, size_t, size_t);
+
+/* Explicit stacks replace recursion over patterns of any size: v starts
+ * in a local buffer of STACKINIT elements and STACKROOM() makes room for
+ * k more on top of the n in use, doubling max as needed.
+ */
+#define STACKINIT 16
+#define STACKROOM(a, v, n, max, k) \
+    do { \
+        while ((n) + (k) > (max)) \
+        { \
+            (v) = arenagrow((a), (v), (max)*sizeof(*(v)), 2*(max)*sizeof(*(v))); \
+            (max) *= 2; \
+        } \
+    } while (0)
+extern void arenafree(Arena *);
 
 /* Parser status */
 struct Parse
 {
     int parseError;
+    /* Capturing groups opened so far, see the lexer in parse() */
     int nparen;
+    /* Flags given to parse() */
+    unsigned int flags;
     Regexp *ast_root;
+    /* Every AST node comes from here */
+    Arena *arena;
 };
 
-extern void *uregParserAlloc(void *(*mallocProc)(size_t));
-extern void uregParserFree(void *p, void (*freeProc)(void*));
+extern size_t uregParserSize(void);
+extern void *uregParserInit(void *);
 extern void uregParser(void *, int, int, Parse *);
 #ifndef NDEBUG
 extern void uregParserTrace(FILE *, char *);
 #endif
 
-/* An AST node */
+/* An AST node. Nodes are allocated from the Arena given to parse() and
+ * may be shared between several parents (see simplify_repeat()).
+ */
 struct Regexp
 {
     int type;
     int n;
     int ch;
     int lo, hi;
-    int refc;
     Regexp *left;
     Regexp *right;
+    /* Class: CLASSBYTES bit set indexed by unsigned byte */
+    unsigned char *bits;
+    /* Str: n characters */
+    char *str;
 };
 
 /* AST node types (Regexp.type) */
@@ -55,53 +117,96 @@ enum
     Quest,
     Star,
     Plus,
-    Paren
+    Paren,
+    Count,
+    Class,
+    Str
 };
 
-extern Regexp *parse(const char *);
-extern Regexp *reg(int, Regexp *, Regexp *);
-extern void reg_destroy(Regexp *);
-#define reg_incref(r)               \
-    do {                            \
-        Regexp *lr = (r);           \
-        if (lr)                     \
-            lr->refc++;             \
-    } while (0)
-#define reg_decref(r)               \
-    do {                            \
-        Regexp *lr = (r);           \
-        if (lr)                     \
-        {                           \
-            lr->refc--;             \
-            if (lr->refc <= 0)      \
-                reg_destroy(lr);    \
-        }                           \
-    } while (0)
+extern Regexp *parse(const char *, Arena *, unsigned int);
+extern Regexp *reg(Arena *, int, Regexp *, Regexp *);
+
+/* Character class bit sets, NUL is never a member */
+#define CLASSBYTES      32
+#define CLASSHAS(bits, b)   ((bits)[(unsigned char)(b) >> 3] & (1 << ((unsigned char)(b) & 7)))
+
+extern void classadd(unsigned char *, Regexp *);
+extern Regexp *classnode(Arena *, unsigned char *);
+extern Regexp *bracket(Arena *, Regexp *, int);
 
-extern Regexp *simplify_repeat(Regexp *, int, int, int);
+extern Regexp *simplify_repeat(Arena *, Regexp *, int, int, int, int);
+extern int expand_counts(Arena *, Regexp *);
+extern Regexp *optimize(Arena *, Regexp *, unsigned int);
+extern Regexp *reversed(Arena *, Regexp *);
 #if !defined(NDEBUG) && defined(UREG_TRACE)
 extern void printre(Regexp *);
 #endif
 extern void fatal(char *, ...);
-extern void *mal(size_t);
 
-struct Prog
+/* Instructions refer to each other by index into Prog.start, so a
+ * program is a single position-independent block which is never written
+ * to once compiled: all the mutable state of a match lives in the VM.
+ *
+ * An instruction takes 16 bytes. Fields are shared between opcodes, and
+ * data which does not fit (class bit sets, literal bytes and Repeat
+ * parameters) lives in tables stored after the instructions.
+ */
+struct Inst
 {
-    Inst *start;
-    int len;
+    unsigned char opcode;
+    /* Char: the character. Rng: the bounds, compared as plain chars */
+    char c;
+    char lo, hi;
+    /* Save: slot. String: length. Repeat: body width. Repeat bodies:
+     * position in the body
+     */
+    int n;
+    /* Jmp, Split: target. Repeat: first instruction after the body */
+    int x;
+    /* Split: second target. Set: bit set. String: offset of the bytes.
+     * Repeat: parameters.
+     */
+    int y;
 };
 
-struct Inst
+/* Parameters of a Repeat instruction */
+typedef struct RepeatArgs RepeatArgs;
+struct RepeatArgs
 {
-    int opcode;
-    int c;
-    int n;
     int lo, hi;
-    Inst *x;
-    Inst *y;
-    int gen;
+    /* First counter word, see REPEATWORDS() */
+    int cnt;
+};
+
+struct Prog
+{
+    int len;
+    /* Counter words needed by Repeat instructions */
+    int ncount;
+    /* Tables, stored after the instructions in this order */
+    int nrepeat;
+    int nclosure;
+    int nstr;
+    int nclass;
+    Inst start[1];
 };
 
+/* Size in bytes of a program with n instructions, r Repeat parameters,
+ * e words of epsilon closures, s bytes of literals and c class bit sets
+ */
+#define PROGSIZE(n, r, e, s, c) (sizeof(Prog) + ((n) - 1)*sizeof(Inst) + \
+                                 (size_t)(r)*sizeof(RepeatArgs) + \
+                                 (size_t)(e)*sizeof(int) + (size_t)(s) + \
+                                 (size_t)(c)*CLASSBYTES)
+/* Parameters k of program p */
+#define PROGREPEAT(p, k)    ((RepeatArgs *)((p)->start + (p)->len) + (k))
+/* Epsilon closures of program p, see below */
+#define PROGCLOSURE(p)      ((int *)PROGREPEAT(p, (p)->nrepeat))
+/* Literals of program p */
+#define PROGSTR(p)          ((char *)(PROGCLOSURE(p) + (p)->nclosure))
+/* Bit set k of program p */
+#define PROGCLASS(p, k)     ((unsigned char *)PROGSTR(p) + (p)->nstr + (size_t)(k)*CLASSBYTES)
+
 /* Opcodes (Inst.opcode) */
 enum
 {
@@ -111,14 +216,187 @@ enum
     Split,
     Any,
     Save,
-    Rng
+    Rng,
+    Repeat,
+    /* Any byte in the bit set PROGCLASS(p, y) */
+    Set,
+    /* The n bytes at PROGSTR(p) + y */
+    String
 };
 
-extern Prog *compile(Regexp *);
+/* Epsilon closures.
+ *
+ * Adding a thread at a Jmp, Split or Save means walking the graph of
+ * epsilon transitions from it, which always gives the same result. The
+ * compiler does the walk in advance for every instruction a thread may
+ * be added at after consuming a byte (see closures() in compile.c): if
+ * PROGCLOSURE(p)[i] is not -1 it is the index, in the same table, of the
+ * number of instructions in the closure of i, followed by its first-byte
+ * set and their indices in the order the walk finds them. Only consuming
+ * instructions, Match and Repeat appear there; the closure of a Repeat
+ * which can be skipped includes its continuation. Programs whose tables
+ * would be too big have none (nclosure == 0).
+ *
+ * The first-byte set is the class bit set (PROGCLASS()) of the bytes the
+ * consuming instructions of the closure accept first, or -1 when it holds
+ * Match or Repeat. With UREG_LOOKAHEAD the VM skips closures which cannot
+ * get past the next input byte.
+ */
+
+/* Counted repetition of a fixed-width body.
+ *
+ * A Repeat instruction is followed by the instructions of its body, up
+ * to x, which are only ever executed through it: body instructions are
+ * single character matchers tagged with their position in the body
+ * (Inst.n, from 0 to the width of the body, which is the Repeat's n).
+ * Execution continues at x once lo to hi (hi == -1: no upper bound)
+ * iterations have been matched; lo and hi are in the RepeatArgs y.
+ *
+ * Rather than one thread per iteration, the VM keeps a bit vector per
+ * body position whose bit j is set when some thread is there after j
+ * complete iterations. Bits go from 0 to hi - 1; with no upper bound all
+ * counts from lo on behave the same and share a saturating top bit.
+ * The vectors of a Repeat start at word cnt of the counter area.
+ */
+typedef unsigned long CountWord;
+#define COUNTBITS           (8*sizeof(CountWord))
+#define REPEATBITS(a)       ((a)->hi >= 0 ? (a)->hi : (a)->lo + 1)
+#define REPEATSTRIDE(a)     ((REPEATBITS(a) + COUNTBITS - 1) / COUNTBITS)
+#define REPEATWORDS(i, a)   ((i)->n * REPEATSTRIDE(a))
+
+/* Minimum number of iterations compiled to a Repeat; smaller counted
+ * repetitions are expanded, which is faster for a handful of copies.
+ */
+#ifndef UREG_REPEAT_MIN
+# define UREG_REPEAT_MIN    16
+#endif
+
+extern Prog *compile(Regexp *, Arena *, unsigned int);
+extern size_t progsize(Prog *);
 #if !defined(NDEBUG) && defined(UREG_TRACE)
 extern void printprog(Prog *);
 #endif
 
-extern int thompsonvm(Prog *, const char *);
+extern int thompsonvm(Prog *, const char *, ureg_matcher, int);
+extern int pikevm(Prog *, const char *, int *, int, ureg_matcher);
+
+/* Largest bitmap of visited (instruction, input position) pairs, in
+ * bits, for which the backtracker is preferred to the VMs (see
+ * bitstate.c). Its scratch memory is about an eighth of that in bytes.
+ */
+#ifndef UREG_BITSTATE_MAX
+# define UREG_BITSTATE_MAX  (256*1024)
+#endif
+
+extern int bitstate(Prog *, const char *, int, int *, int, ureg_matcher);
+
+/* One-pass tables for submatch extraction, see onepass.c */
+typedef struct OnePass OnePass;
+
+extern OnePass *onepassbuild(Prog *, const ureg_allocator *);
+extern int onepassexec(OnePass *, const char *, int *, int, ureg_matcher);
+extern void onepassfree(OnePass *, const ureg_allocator *);
+
+/* Substring search for literal patterns and for two strings with a gap
+ * in between, see literal.c. Patterns with more alternatives than
+ * UREG_LITERAL_MAXALT are left to the automata.
+ */
+#ifndef UREG_LITERAL_MAXALT
+# define UREG_LITERAL_MAXALT 8
+#endif
+
+typedef struct Literal Literal;
+
+extern Literal *literalbuild(const char *, unsigned int, const ureg_allocator *);
+extern int literalexec(Literal *, const char *, int *, int);
+extern int literalgap(const Literal *);
+extern Literal *literalstring(const char *, long, const ureg_allocator *);
+extern long literalfind(Literal *, const char *, long);
+extern void literalfree(Literal *, const ureg_allocator *);
+
+/* Automata run around a string every match needs, see reverse.c */
+typedef struct Reverse Reverse;
+
+extern Reverse *reversebuild(Regexp *, unsigned int, Arena *, const ureg_allocator *);
+extern int reverseexec(Reverse *, const char *);
+extern int reversesuffix(const Reverse *);
+extern void reversefree(Reverse *, const ureg_allocator *);
+
+/* Choice of engines, see plan.c */
+extern void plan(struct ureg_regexp_t *, Regexp *, Prog *);
+extern int shortlen(const char *, size_t);
+
+/* Deterministic automaton. trans[] holds 256 entries per state, indexed
+ * by unsigned input byte; each entry is the next state id, DfaDead or
+ * DfaMatch.
+ */
+typedef struct Dfa Dfa;
+struct Dfa
+{
+    int nstate;
+    int start;
+    int trans[1];
+};
+
+enum
+{
+    DfaDead = -1,
+    DfaMatch = -2
+};
+
+extern Dfa *dfabuild(Prog *, int, const ureg_allocator *);
+extern Prog *expandstrings(Prog *, const ureg_allocator *);
+
+/* Native code generated from a program */
+typedef struct Jit Jit;
+
+extern Jit *jitcompile(Prog *, const char *, int, const ureg_allocator *);
+extern int jitexec(Jit *, const char *);
+extern void jitfree(Jit *, const ureg_allocator *);
+
+/* Actual declaration of struct ureg_regexp_t */
+struct ureg_regexp_t
+{
+    /* Original text representation */
+    const char *txt;
+    /* Compiled regexp (intermediate AST is not saved) */
+    Prog *p;
+    /* Native code, NULL if not requested or not available */
+    Jit *jit;
+    /* Table for captures, NULL unless UREG_CAPTURE | UREG_ANCHORED and
+     * the program is one-pass
+     */
+    OnePass *onepass;
+    /* Searcher for literal patterns, NULL for other ones */
+    Literal *literal;
+    /* Automata around a string every match needs, NULL if unused */
+    Reverse *reverse;
+    /* Engines to run, see plan.c */
+    ureg_strategy strategy;
+    /* Flags given to ureg_compile() */
+    unsigned int flags;
+    /* Reference count, updated atomically */
+    int refc;
+    /* Allocator owning the handle and its native code */
+    ureg_allocator alloc;
+    /* Pointer to be released, the handle itself may be aligned past it */
+    void *mem;
+};
+
+/* Compiled handles are allocated as a single block, with the program and
+ * the pattern text right after the header (see ureg_compile()). Handles
+ * returned by ureg_load() point into the serialized blob instead.
+ */
+#define UREG_CACHELINE      64
+#define UREG_HANDLESIZE     ((sizeof(struct ureg_regexp_t) + UREG_CACHELINE - 1) & ~(size_t)(UREG_CACHELINE - 1))
+
+/* Atomic reference counting, both return the updated value */
+#ifdef HAVE_SYNC_BUILTINS
+# define ureg_refinc(p)     __sync_add_and_fetch((p), 1)
+# define ureg_refdec(p)     __sync_sub_and_fetch((p), 1)
+#else
+extern int ureg_refinc(int *);
+extern int ureg_refdec(int *);
+#endif /* HAVE_SYNC_BUILTINS */
 
 #endif /* INCLUDED_ureg_internal_h */
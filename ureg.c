@@ -10,66 +10,110 @@
 #define UREG_INTERNAL
 #include "ureg-internal.h"
 
-/* Actual declaration of struct ureg_regexp_t */
-struct ureg_regexp_t
-{
-    /* Original text representation */
-    const char *txt;
-    /* Compiled regexp (intermediate AST is not saved) */
-    Prog *p;
-};
-
 ureg_error_t ureg_errno = UREG_NOERROR;
 
 /* Compile a regexp and return an handler */
 ureg_regexp
 ureg_compile(const char *pattern, unsigned int flags)
+{
+    return ureg_compile_with(pattern, flags, NULL);
+}
+
+/* Compile a regexp, allocating memory from a given allocator */
+ureg_regexp
+ureg_compile_with(const char *pattern, unsigned int flags, const ureg_allocator *allocator)
 {
     Regexp *r;
+    Arena arena;
+    jmp_buf oom;
+    Prog *p, *native;
+    ureg_allocator alloc;
     struct ureg_regexp_t *res;
+    size_t psize, tsize;
+    void *mem;
     if(pattern == NULL)
     {
         ureg_errno = UREG_ERR_NULL;
         return NULL;
     }
+    if(allocator != NULL && (allocator->alloc == NULL || allocator->free == NULL))
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return NULL;
+    }
+    alloc = allocator != NULL ? *allocator : *curalloc();
 
-    /* Parse the regexp and build the equivalent AST */
-    if((r = parse(pattern)) == NULL)
+    /* Parse the regexp and build the equivalent AST. Nothing but the
+     * arena is allocated until the handle is, so running out of memory
+     * before that only has to release the arena.
+     */
+    arenainit(&arena, &alloc, &oom);
+    if(setjmp(oom))
     {
+        arenafree(&arena);
+        ureg_errno = UREG_ERR_NOMEM;
+        return NULL;
+    }
+    if((r = parse(pattern, &arena, flags)) == NULL)
+    {
+        arenafree(&arena);
         ureg_errno = UREG_ERR_SYNTAX;
         return NULL;
     }
-    /* Keep the root node of the AST referenced */
-    reg_incref(r);
+    r = optimize(&arena, r, flags);
 #if !defined(NDEBUG) && defined(UREG_TRACE)
     fprintf(stderr, "AST: ");
     printre(r);
     fprintf(stderr, "\n");
 #endif
-    res = (struct ureg_regexp_t *)malloc(sizeof(struct ureg_regexp_t));
-    if(res == NULL)
+
+    /* Compile the AST into the final NFA program */
+    if((p = compile(r, &arena, flags)) == NULL)
     {
-        ureg_errno = UREG_ERR_NOMEM;
-        reg_decref(r);
+        ureg_errno = UREG_ERR_COMPILE;
+        arenafree(&arena);
         return NULL;
     }
+    native = NULL;
+    if(flags & UREG_JIT)
+    {
+        /* Native code comes from a DFA, which needs counters expanded */
+        native = p;
+        if(expand_counts(&arena, r) > 0)
+            native = compile(r, &arena, flags);
+    }
 
-    /* Compile the AST into the final NFA program */
-    if((res->p = compile(r)) == NULL)
+    /* Lay out header, program and text form in a single block */
+    psize = progsize(p);
+    tsize = strlen(pattern) + 1;
+    res = (struct ureg_regexp_t *)ulinealloc(&alloc, UREG_HANDLESIZE + psize + tsize, &mem);
+    if(res == NULL)
     {
-        ureg_errno = UREG_ERR_COMPILE;
-        reg_decref(r);
-        free(res);
+        ureg_errno = UREG_ERR_NOMEM;
+        arenafree(&arena);
         return NULL;
     }
+    res->p = (Prog *)((char *)res + UREG_HANDLESIZE);
+    memcpy(res->p, p, psize);
+    res->txt = (char *)res->p + psize;
+    memcpy((char *)res->txt, pattern, tsize);
 
-    /* Success, throw away the AST, duplicate text form and return */
-    reg_decref(r);
 #if !defined(NDEBUG) && defined(UREG_TRACE)
     fprintf(stderr, "Program:\n");
     printprog(res->p);
 #endif
-    res->txt = strdup(pattern); /* FIXME: check for OOM */
+    res->jit = NULL;
+    res->onepass = NULL;
+    res->literal = NULL;
+    res->reverse = NULL;
+    res->flags = flags;
+    res->refc = 1;
+    res->alloc = alloc;
+    res->mem = mem;
+    plan(res, r, native);
+
+    /* Success, throw away the AST and the scratch programs */
+    arenafree(&arena);
     ureg_errno = UREG_NOERROR;
     return res;
 }
@@ -78,30 +122,192 @@ ureg_compile(const char *pattern, unsigned int flags)
 void
 ureg_free(ureg_regexp handle)
 {
+    ureg_allocator alloc;
+
     if(handle == NULL)
     {
         ureg_errno = UREG_ERR_NULL;
         return;
     }
-    if(handle->txt)
-        free((char *)handle->txt);
-    if(handle->p)
-        free(handle->p);
-    free(handle);
+    /* Shared handles (see ureg_cache_compile()) go away with the last
+     * reference
+     */
     ureg_errno = UREG_NOERROR;
+    if(ureg_refdec(&handle->refc) > 0)
+        return;
+    /* The allocator lives in the block being released */
+    alloc = handle->alloc;
+    jitfree(handle->jit, &alloc);
+    onepassfree(handle->onepass, &alloc);
+    literalfree(handle->literal, &alloc);
+    reversefree(handle->reverse, &alloc);
+    ufree(&alloc, handle->mem);
 }
 
 /* Match a string against a regexp */
 int
 ureg_match(ureg_regexp handle, const char *s)
 {
+    return ureg_matcher_match(NULL, handle, s);
+}
+
+/* Create a matcher */
+ureg_matcher
+ureg_matcher_new(const ureg_allocator *allocator)
+{
+    const ureg_allocator *alloc = allocator != NULL ? allocator : curalloc();
+    ureg_matcher m;
+
+    if(alloc->alloc == NULL || alloc->free == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return NULL;
+    }
+    if((m = (ureg_matcher)ualloc(alloc, sizeof(*m))) == NULL)
+    {
+        ureg_errno = UREG_ERR_NOMEM;
+        return NULL;
+    }
+    m->alloc = *alloc;
+    m->mem = NULL;
+    m->size = 0;
+    ureg_errno = UREG_NOERROR;
+    return m;
+}
+
+/* Match a string against a regexp, reusing a matcher's scratch memory.
+ * A NULL matcher stands for a temporary one using the regexp's allocator.
+ */
+int
+ureg_matcher_match(ureg_matcher matcher, ureg_regexp handle, const char *s)
+{
+    struct ureg_matcher_t tmp;
+    int len, res;
+
     if(handle == NULL || s == NULL || handle->p == NULL)
     {
         ureg_errno = UREG_ERR_NULL;
         return -1;
     }
     ureg_errno = UREG_NOERROR;
-    return thompsonvm(handle->p, s);
+    if(handle->strategy.match == UREG_ENGINE_JIT)
+        return jitexec(handle->jit, s);
+    if(handle->strategy.match == UREG_ENGINE_LITERAL)
+        return literalexec(handle->literal, s, NULL, 0);
+    len = -1;
+    if(handle->strategy.shortmatch != handle->strategy.match)
+        len = shortlen(s, handle->strategy.shortmax);
+    /* Past its budget the reverse search leaves the input to the VM */
+    if(len < 0 && handle->strategy.match == UREG_ENGINE_REVERSE &&
+       (res = reverseexec(handle->reverse, s)) >= 0)
+        return res;
+    if(matcher == NULL)
+    {
+        tmp.alloc = handle->alloc;
+        tmp.mem = NULL;
+        tmp.size = 0;
+    }
+    /* Short inputs are cheaper to backtrack over */
+    if(len >= 0)
+        res = bitstate(handle->p, s, len, NULL, 0, matcher != NULL ? matcher : &tmp);
+    else
+        res = thompsonvm(handle->p, s, matcher != NULL ? matcher : &tmp, handle->flags & UREG_LOOKAHEAD);
+    if(matcher == NULL)
+        ufree(&tmp.alloc, tmp.mem);
+    return res;
+}
+
+/* Match a string against a regexp and report submatches */
+int
+ureg_match_captures(ureg_regexp handle, const char *s, int *caps, int ncap)
+{
+    return ureg_matcher_captures(NULL, handle, s, caps, ncap);
+}
+
+/* Report submatches, reusing a matcher's scratch memory. A NULL matcher
+ * stands for a temporary one using the regexp's allocator.
+ */
+int
+ureg_matcher_captures(ureg_matcher matcher, ureg_regexp handle, const char *s, int *caps, int ncap)
+{
+    struct ureg_matcher_t tmp;
+    int len, res;
+
+    if(handle == NULL || s == NULL || handle->p == NULL || ncap < 0 || (caps == NULL && ncap > 0))
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return -1;
+    }
+    if(!(handle->flags & UREG_CAPTURE))
+    {
+        ureg_errno = UREG_ERR_CAPTURE;
+        return -1;
+    }
+    ureg_errno = UREG_NOERROR;
+    if(handle->strategy.capture == UREG_ENGINE_LITERAL)
+        return literalexec(handle->literal, s, caps, ncap);
+    if(matcher == NULL)
+    {
+        tmp.alloc = handle->alloc;
+        tmp.mem = NULL;
+        tmp.size = 0;
+    }
+    len = -1;
+    if(handle->strategy.shortcapture != handle->strategy.capture)
+        len = shortlen(s, handle->strategy.shortmax);
+    if(handle->strategy.capture == UREG_ENGINE_ONEPASS)
+        res = onepassexec(handle->onepass, s, caps, ncap, matcher != NULL ? matcher : &tmp);
+    else if(len >= 0)
+        res = bitstate(handle->p, s, len, caps, ncap, matcher != NULL ? matcher : &tmp);
+    else
+        res = pikevm(handle->p, s, caps, ncap, matcher != NULL ? matcher : &tmp);
+    if(matcher == NULL)
+        ufree(&tmp.alloc, tmp.mem);
+    return res;
+}
+
+/* Get the engines chosen for a regexp */
+void
+ureg_getstrategy(ureg_regexp handle, ureg_strategy *strategy)
+{
+    if(handle == NULL || strategy == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return;
+    }
+    *strategy = handle->strategy;
+    ureg_errno = UREG_NOERROR;
+}
+
+/* Printable engine names, in ureg_engine_t order */
+static const char *enginenames[] = {
+    "none", "nfa", "jit", "backtrack", "onepass", "pikevm", "literal",
+    "reverse"
+};
+
+const char *
+ureg_engine_name(ureg_engine_t engine)
+{
+    if((int)engine < 0 || (size_t)engine >= sizeof(enginenames)/sizeof(enginenames[0]))
+        return NULL;
+    return enginenames[engine];
+}
+
+/* Destroy a matcher */
+void
+ureg_matcher_free(ureg_matcher matcher)
+{
+    ureg_allocator alloc;
+
+    if(matcher == NULL)
+    {
+        ureg_errno = UREG_ERR_NULL;
+        return;
+    }
+    alloc = matcher->alloc;
+    ufree(&alloc, matcher->mem);
+    ufree(&alloc, matcher);
+    ureg_errno = UREG_NOERROR;
 }
 
 /* Return a string representation of a given regexp */
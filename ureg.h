@@ -9,6 +9,8 @@
 #ifndef INCLUDED_ureg_h
 #define INCLUDED_ureg_h
 
+#include <stddef.h>
+
 /**
  * @addtogroup types Types and variables
  */
@@ -21,6 +23,126 @@
  */
 typedef struct ureg_regexp_t *ureg_regexp;
 
+/** @brief Opaque handler to a set of regexps in shared memory.
+ *  @sa ureg_set_compile(), ureg_set_open(), ureg_set_free()
+ */
+typedef struct ureg_set_t *ureg_set;
+
+/** @brief Opaque handler to a cache of compiled regexps.
+ *  @sa ureg_cache_new(), ureg_cache_compile(), ureg_cache_free()
+ */
+typedef struct ureg_cache_t *ureg_cache;
+
+/** @brief Opaque handler to matcher scratch memory.
+ *  @sa ureg_matcher_new(), ureg_matcher_match(), ureg_matcher_free()
+ */
+typedef struct ureg_matcher_t *ureg_matcher;
+
+/** @brief Memory allocator.
+ *
+ *  Both functions receive ctx as their first argument. alloc() returns
+ *  NULL on failure and free() is never called with a NULL pointer.
+ *  @sa ureg_set_allocator(), ureg_compile_with(), ureg_matcher_new()
+ */
+typedef struct ureg_allocator_t
+{
+    /** @brief Allocate size bytes (suitably aligned for any type) */
+    void *(*alloc)(void *ctx, size_t size);
+    /** @brief Release memory returned by alloc() */
+    void (*free)(void *ctx, void *ptr);
+    /** @brief Opaque pointer given back to alloc() and free() */
+    void *ctx;
+} ureg_allocator;
+
+/** @brief Cache statistics.
+ *  @sa ureg_cache_getstats()
+ */
+typedef struct ureg_cache_stats_t
+{
+    /** @brief Lookups satisfied by the cache */
+    unsigned long hits;
+    /** @brief Lookups which required a compilation */
+    unsigned long misses;
+    /** @brief Regexps dropped to make room for new ones */
+    unsigned long evictions;
+    /** @brief Regexps currently in the cache */
+    size_t entries;
+} ureg_cache_stats;
+
+/** @brief Matching engines.
+ *  @sa ureg_strategy, ureg_engine_name()
+ */
+typedef enum ureg_engine_t
+{
+    /** @brief No engine (captures of a regexp compiled without
+     *  UREG_CAPTURE) */
+    UREG_ENGINE_NONE = 0,
+    /** @brief Simulation of the automaton, all states at once */
+    UREG_ENGINE_NFA,
+    /** @brief Native code (UREG_JIT) */
+    UREG_ENGINE_JIT,
+    /** @brief Backtracking, with a bit per state and input position */
+    UREG_ENGINE_BACKTRACK,
+    /** @brief Table of a one-pass pattern */
+    UREG_ENGINE_ONEPASS,
+    /** @brief Simulation of the automaton tracking captures */
+    UREG_ENGINE_PIKEVM,
+    /** @brief Substring search, for patterns without metacharacters
+     *  (or with just a gap of any bytes) */
+    UREG_ENGINE_LITERAL,
+    /** @brief Substring search for a string every match needs, then
+     *  automata run around it (backwards for what comes before) */
+    UREG_ENGINE_REVERSE
+} ureg_engine_t;
+
+/** @brief Properties of a pattern, found when it is compiled.
+ *  @sa ureg_strategy
+ */
+typedef enum ureg_prop_t
+{
+    /** @brief Only matches at the start of the string */
+    UREG_PROP_ANCHORED = 1 << 0,
+    /** @brief Records capturing groups */
+    UREG_PROP_CAPTURE = 1 << 1,
+    /** @brief The next byte always tells which way a match goes */
+    UREG_PROP_ONEPASS = 1 << 2,
+    /** @brief Uses counters for long counted repetitions */
+    UREG_PROP_COUNTERS = 1 << 3,
+    /** @brief A string or a few alternative strings, nothing else */
+    UREG_PROP_LITERAL = 1 << 4,
+    /** @brief Two strings with any bytes in between, e.g. "foo.*bar" */
+    UREG_PROP_GAP = 1 << 5,
+    /** @brief Every match ends with a string, e.g. "[0-9]+ms" */
+    UREG_PROP_SUFFIX = 1 << 6,
+    /** @brief Every match goes through a string, e.g. "[a-z]+ing[a-z]*" */
+    UREG_PROP_INNER = 1 << 7
+} ureg_prop_t;
+
+/** @brief Engines chosen for a compiled regexp.
+ *
+ *  Engines are chosen once per regexp, and between the short and the
+ *  long input variants at every call.
+ *  @sa ureg_getstrategy()
+ */
+typedef struct ureg_strategy_t
+{
+    /** @brief Engine used by ureg_match() on long inputs */
+    ureg_engine_t match;
+    /** @brief Engine used by ureg_match() on short inputs */
+    ureg_engine_t shortmatch;
+    /** @brief Engine used by ureg_match_captures() on long inputs */
+    ureg_engine_t capture;
+    /** @brief Engine used by ureg_match_captures() on short inputs */
+    ureg_engine_t shortcapture;
+    /** @brief Longest short input, in bytes (0 if short inputs get the
+     *  same engines as long ones) */
+    size_t shortmax;
+    /** @brief Bitwise OR of ureg_prop_t values */
+    unsigned int props;
+    /** @brief Size of the compiled program, in instructions */
+    size_t size;
+} ureg_strategy;
+
 /** @brief Error codes.
  *  @sa ureg_errno
  */
@@ -35,10 +157,59 @@ typedef enum ureg_error_t
     /** @brief Syntax error */
     UREG_ERR_SYNTAX,
     /** @brief Compiler error, please report this */
-    UREG_ERR_COMPILE
+    UREG_ERR_COMPILE,
+    /** @brief Serialized regexp is corrupt or was written by an
+     *  incompatible host or library version */
+    UREG_ERR_FORMAT,
+    /** @brief Submatches requested from a regexp compiled without
+     *  UREG_CAPTURE */
+    UREG_ERR_CAPTURE
 } ureg_error_t;
 
-/** @brief Last error code */
+/** @brief Compilation flags.
+ *  @sa ureg_compile()
+ */
+typedef enum ureg_flags_t
+{
+    /** @brief Translate the regexp to native code, if the platform
+     *  supports it and the regexp is small enough; silently falls back
+     *  to the interpreter otherwise */
+    UREG_JIT = 1 << 0,
+    /** @brief Register native code in /tmp/perf-<pid>.map so that
+     *  perf(1) can symbolize it (only meaningful with UREG_JIT) */
+    UREG_JIT_PERFMAP = 1 << 1,
+    /** @brief Keep capturing groups in the parse tree */
+    UREG_NOOPT_PAREN = 1 << 2,
+    /** @brief Do not flatten nested concatenations and alternations */
+    UREG_NOOPT_FLATTEN = 1 << 3,
+    /** @brief Do not factor common prefixes out of alternations */
+    UREG_NOOPT_PREFIX = 1 << 4,
+    /** @brief Do not merge single character alternatives into classes */
+    UREG_NOOPT_CLASS = 1 << 5,
+    /** @brief Do not merge consecutive literals into strings, nor
+     *  search for strings (UREG_ENGINE_LITERAL, UREG_ENGINE_REVERSE) */
+    UREG_NOOPT_STRING = 1 << 6,
+    /** @brief Disable every optimization pass (the UREG_NOOPT_* flags
+     *  only exist for benchmarking and testing: results never change) */
+    UREG_NOOPT = UREG_NOOPT_PAREN | UREG_NOOPT_FLATTEN | UREG_NOOPT_PREFIX |
+                 UREG_NOOPT_CLASS | UREG_NOOPT_STRING,
+    /** @brief Look one byte ahead when the interpreter spawns threads,
+     *  dropping those which cannot match it: fewer threads per byte on
+     *  alternation-heavy patterns, at the price of a test per thread */
+    UREG_LOOKAHEAD = 1 << 7,
+    /** @brief Record the position of capturing groups, for
+     *  ureg_match_captures(). Groups are kept through every
+     *  optimization pass and counted repetitions are always expanded */
+    UREG_CAPTURE = 1 << 8,
+    /** @brief Only match at the start of the string */
+    UREG_ANCHORED = 1 << 9
+} ureg_flags_t;
+
+/** @brief Last error code
+ *
+ *  This is a plain global: when regexps are shared between threads
+ *  (e.g. through ureg_cache_compile()), check return values instead.
+ */
 extern ureg_error_t ureg_errno;
 
 /** @} */
@@ -52,13 +223,33 @@ extern ureg_error_t ureg_errno;
 /** @brief Compile a regexp.
  *
  *  @param pattern pattern being compiled.
- *  @param flags flags for parser/compiler (currently unused)
+ *  @param flags bitwise OR of ureg_flags_t values, or 0.
  *  @return A compiled regexp handler.
  *  @sa ureg_free(), ureg_match()
  */
 extern ureg_regexp ureg_compile(const char *pattern, unsigned int flags);
 
+/** @brief Compile a regexp using a specific allocator.
+ *
+ *  Every allocation made while compiling, and every allocation owned by
+ *  the returned handle (including memory used by ureg_match()), goes
+ *  through allocator. The allocator is copied, and must stay usable
+ *  until the handle is released with ureg_free(). If it fails while
+ *  compiling, everything is released and NULL returned with ureg_errno
+ *  set to UREG_ERR_NOMEM; failures while building the tables of an
+ *  optional engine only leave that engine out.
+ *  @param pattern pattern being compiled.
+ *  @param flags bitwise OR of ureg_flags_t values, or 0.
+ *  @param allocator allocator, NULL for the global one.
+ *  @return A compiled regexp handler.
+ *  @sa ureg_compile(), ureg_set_allocator()
+ */
+extern ureg_regexp ureg_compile_with(const char *pattern, unsigned int flags, const ureg_allocator *allocator);
+
 /** @brief Destroy a previously compiled regexp and free its memory.
+ *
+ *  For handles returned by ureg_cache_compile() this drops a reference,
+ *  the regexp is destroyed once the last one is gone.
  *  @param handle Regexp handle being free()'d.
  *  @sa ureg_compile()
  */
@@ -71,6 +262,92 @@ extern void ureg_free(ureg_regexp handle);
  */
 extern int ureg_match(ureg_regexp handle, const char *str);
 
+/** @brief Create reusable scratch memory for matching.
+ *
+ *  ureg_match() allocates (and releases) its working memory on every
+ *  call; a matcher keeps it around instead, so that repeated matches
+ *  do not allocate at all once it has grown to the largest regexp seen.
+ *  A matcher must not be used by more than one thread at a time.
+ *  @param allocator allocator for the scratch memory, NULL for the
+ *  global one.
+ *  @return A matcher handle, NULL on error.
+ *  @sa ureg_matcher_match(), ureg_matcher_free()
+ */
+extern ureg_matcher ureg_matcher_new(const ureg_allocator *allocator);
+
+/** @brief Match a string using a matcher's scratch memory.
+ *  @param matcher A matcher handle
+ *  @param handle Handle to regexp.
+ *  @param str string being tested.
+ *  @return 1 if str matches, 0 if it does not match, -1 on error.
+ *  @sa ureg_match()
+ */
+extern int ureg_matcher_match(ureg_matcher matcher, ureg_regexp handle, const char *str);
+
+/** @brief Match a string and report where capturing groups matched.
+ *
+ *  Group 0 is the whole match, group i the i-th opening parenthesis of
+ *  a capturing group. Of all the matches starting leftmost, the one
+ *  found first taking alternatives and repetitions in priority order
+ *  (left to right, greedy before non-greedy) is reported, as in Perl.
+ *  Within repetitions groups hold their last iteration. Anchored
+ *  patterns which are one-pass (at every point of the match the next
+ *  byte tells which way to go, e.g. "([a-z]+)=([0-9]*)") are run on a
+ *  precomputed table, others on an engine depending on the length of
+ *  str (see ureg_getstrategy()).
+ *  @param handle Handle to a regexp compiled with UREG_CAPTURE.
+ *  @param str string being tested.
+ *  @param caps receives 2*ncap byte offsets into str: caps[2*i] and
+ *  caps[2*i+1] are the start and the end of group i, both -1 if the
+ *  group did not take part in the match (or does not exist).
+ *  Undefined if there is no match.
+ *  @param ncap number of groups to report.
+ *  @return 1 if str matches, 0 if it does not match, -1 on error.
+ *  @sa ureg_matcher_captures()
+ */
+extern int ureg_match_captures(ureg_regexp handle, const char *str, int *caps, int ncap);
+
+/** @brief Report capturing groups using a matcher's scratch memory.
+ *  @param matcher A matcher handle
+ *  @param handle Handle to a regexp compiled with UREG_CAPTURE.
+ *  @param str string being tested.
+ *  @param caps receives the group offsets, see ureg_match_captures().
+ *  @param ncap number of groups to report.
+ *  @return 1 if str matches, 0 if it does not match, -1 on error.
+ *  @sa ureg_match_captures()
+ */
+extern int ureg_matcher_captures(ureg_matcher matcher, ureg_regexp handle, const char *str, int *caps, int ncap);
+
+/** @brief Get the engines chosen for a regexp.
+ *
+ *  Meant for auditing: matching results never depend on the engines.
+ *  @param handle A regexp handle
+ *  @param strategy filled with the engines and pattern properties.
+ *  @sa ureg_engine_name()
+ */
+extern void ureg_getstrategy(ureg_regexp handle, ureg_strategy *strategy);
+
+/** @brief Get a printable name for an engine.
+ *  @param engine an engine
+ *  @return A static string, NULL for unknown engines.
+ */
+extern const char *ureg_engine_name(ureg_engine_t engine);
+
+/** @brief Destroy a matcher and free its memory.
+ *  @param matcher Matcher handle being free()'d.
+ */
+extern void ureg_matcher_free(ureg_matcher matcher);
+
+/** @brief Replace the global allocator.
+ *
+ *  The global allocator is used by ureg_compile(), ureg_load(), sets,
+ *  caches and matchers created without an explicit allocator. Objects
+ *  keep using the allocator they were created with, so it can be
+ *  changed at any time, but not concurrently with other library calls.
+ *  @param allocator new allocator, NULL to restore malloc() and free().
+ */
+extern void ureg_set_allocator(const ureg_allocator *allocator);
+
 /** @brief Get the original pattern for a given compiled regexp.
  *
  *  The returned pointer is valid until the underlying regexp object
@@ -80,6 +357,124 @@ extern int ureg_match(ureg_regexp handle, const char *str);
  */
 extern const char *ureg_txt(ureg_regexp handle);
 
+/** @brief Serialize a compiled regexp into a binary blob.
+ *
+ *  The blob can be stored (e.g. in a file) and turned back into a regexp
+ *  with ureg_load(). It is only valid for hosts with the same byte order
+ *  and the same libureg version.
+ *  @param handle A regexp handle
+ *  @param buf destination buffer, may be NULL
+ *  @param len size of buf
+ *  @return The size of the serialized regexp, 0 on error. Nothing is
+ *  written if buf is NULL or smaller than the returned size.
+ *  @sa ureg_load()
+ */
+extern size_t ureg_serialize(ureg_regexp handle, void *buf, size_t len);
+
+/** @brief Load a regexp serialized by ureg_serialize().
+ *
+ *  The regexp is used in place: buf is neither copied nor modified, and
+ *  must stay valid (and unchanged) until the returned handle is
+ *  released with ureg_free(). It must be aligned on an 8 byte boundary,
+ *  which is always the case for memory returned by malloc() or mmap().
+ *  @param buf serialized regexp
+ *  @param len size of buf
+ *  @return A regexp handle, NULL on error.
+ *  @sa ureg_serialize(), ureg_free()
+ */
+extern ureg_regexp ureg_load(const void *buf, size_t len);
+
+/** @brief Compile a list of regexps into a read-only shared memory region.
+ *
+ *  The compiled programs are stored in an anonymous shared memory file
+ *  and are matched in place: processes forked afterwards share them
+ *  without copies, and unrelated processes can map them with
+ *  ureg_set_open() given the descriptor returned by ureg_set_fd().
+ *  @param patterns patterns being compiled.
+ *  @param n number of patterns.
+ *  @param flags flags for ureg_compile(), applied to every pattern.
+ *  @return A set handle, NULL on error (including any pattern failing to
+ *  compile).
+ *  @sa ureg_set_get(), ureg_set_free()
+ */
+extern ureg_set ureg_set_compile(const char *const *patterns, size_t n, unsigned int flags);
+
+/** @brief Map a set created by ureg_set_compile(), possibly in another
+ *  process.
+ *
+ *  The descriptor is not closed by ureg_set_free(). Note that descriptors
+ *  created by ureg_set_compile() are close-on-exec: clear FD_CLOEXEC
+ *  before handing them to an exec'd worker.
+ *  @param fd descriptor returned by ureg_set_fd().
+ *  @return A set handle, NULL on error.
+ */
+extern ureg_set ureg_set_open(int fd);
+
+/** @brief Get the descriptor backing a set.
+ *  @param set A set handle
+ *  @return A file descriptor, -1 if shared memory is not available.
+ */
+extern int ureg_set_fd(ureg_set set);
+
+/** @brief Get the number of regexps in a set.
+ *  @param set A set handle
+ *  @return Number of regexps.
+ */
+extern size_t ureg_set_count(ureg_set set);
+
+/** @brief Get a regexp from a set.
+ *
+ *  The handle is owned by the set: it can be used with ureg_match() and
+ *  ureg_txt() until ureg_set_free() is called, but must not be passed
+ *  to ureg_free().
+ *  @param set A set handle
+ *  @param i index of the pattern given to ureg_set_compile()
+ *  @return A regexp handle, NULL if i is out of range.
+ */
+extern ureg_regexp ureg_set_get(ureg_set set, size_t i);
+
+/** @brief Unmap a set and release all of its regexps.
+ *  @param set Set handle being free()'d.
+ */
+extern void ureg_set_free(ureg_set set);
+
+/** @brief Create a cache of compiled regexps.
+ *
+ *  A cache can be used concurrently by any number of threads.
+ *  @param capacity maximum number of regexps kept (approximate, the
+ *  least recently used ones are dropped first).
+ *  @return A cache handle, NULL on error.
+ *  @sa ureg_cache_compile(), ureg_cache_free()
+ */
+extern ureg_cache ureg_cache_new(size_t capacity);
+
+/** @brief Compile a regexp, or reuse a cached copy.
+ *
+ *  The returned handle may be shared with other callers asking for the
+ *  same (pattern, flags) pair; it holds a reference which must be
+ *  dropped with ureg_free() once done, and stays valid until then even
+ *  if it is evicted from the cache or the cache is destroyed.
+ *  @param cache A cache handle
+ *  @param pattern pattern being compiled.
+ *  @param flags flags for ureg_compile().
+ *  @return A compiled regexp handler, NULL on error.
+ */
+extern ureg_regexp ureg_cache_compile(ureg_cache cache, const char *pattern, unsigned int flags);
+
+/** @brief Get cache statistics.
+ *  @param cache A cache handle
+ *  @param stats filled with the cumulative statistics of the cache.
+ */
+extern void ureg_cache_getstats(ureg_cache cache, ureg_cache_stats *stats);
+
+/** @brief Destroy a cache.
+ *
+ *  Regexps still referenced by callers are released by their last
+ *  ureg_free().
+ *  @param cache Cache handle being free()'d.
+ */
+extern void ureg_cache_free(ureg_cache cache);
+
 /** @} */
 
 #endif /* INCLUDED_ureg_h */